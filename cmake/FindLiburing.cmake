@@ -0,0 +1,29 @@
+
+# - Try to find LIBURING
+# Once done this will define
+#  LIBURING_FOUND - System has liburing
+#  LIBURING_INCLUDE_DIRS - The liburing include directories
+#  LIBURING_LIBRARIES - The libraries needed to use liburing
+#  LIBURING_DEFINITIONS - Compiler switches required for using liburing
+
+find_package(PkgConfig)
+pkg_check_modules(PC_LIBURING QUIET liburing)
+set(LIBURING_DEFINITIONS ${PC_LIBURING_CFLAGS_OTHER})
+
+find_path(LIBURING_INCLUDE_DIR liburing.h
+          HINTS ${PC_LIBURING_INCLUDEDIR} ${PC_LIBURING_INCLUDE_DIRS} )
+
+find_library(LIBURING_LIBRARY NAMES uring
+             HINTS ${PC_LIBURING_LIBDIR} ${PC_LIBURING_LIBRARY_DIRS} )
+
+set(LIBURING_LIBRARIES ${LIBURING_LIBRARY} )
+set(LIBURING_INCLUDE_DIRS ${LIBURING_INCLUDE_DIR})
+
+include(FindPackageHandleStandardArgs)
+# handle the QUIETLY and REQUIRED arguments and set LIBURING_FOUND to TRUE
+# if all listed variables are TRUE
+find_package_handle_standard_args(LIBURING DEFAULT_MSG
+                                  LIBURING_LIBRARY LIBURING_INCLUDE_DIR)
+
+mark_as_advanced( LIBURING_FOUND LIBURING_INCLUDE_DIR LIBURING_LIBRARY )
+
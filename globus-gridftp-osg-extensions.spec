@@ -16,6 +16,7 @@ BuildRequires:  globus-gridftp-server-devel
 BuildRequires:  globus-gssapi-gsi-devel
 BuildRequires:  voms-devel
 BuildRequires:  cmake
+BuildRequires:  openssl-devel
 BuildRequires:  voms-devel
 
 %description
@@ -0,0 +1,941 @@
+
+// strptime(), getline(), timegm().
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "osg_extensions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+
+/*************************************************************************
+ * osg-admission-replay
+ * --------------------
+ * Replays historical session arrivals against the transfer limits to see
+ * how candidate GRIDFTP_TRANSFER_LIMIT / per-user limit settings would have
+ * behaved.  Input is any mix of:
+ *
+ *  - transfer log records (`-log-transfer`): each is a session arriving at
+ *    START and holding its slots until DATE.  The records carry no session
+ *    id, so a session which moved several files (and sat idle between
+ *    them) is replayed as several shorter ones; limits count sessions, so
+ *    the replay underestimates how long slots are held by such clients.
+ *  - OSG INFO lines for sessions refused by the limits ("Rejecting
+ *    transfer for ..." / "Failing transfer for ..."): these never ran, so
+ *    they arrive at the log time (less OSG_QUEUE_MAX_WAIT for sessions
+ *    which timed out) and are given the user's mean duration.
+ *
+ * Each arrival goes through the same steps as check_connection_limits():
+ * take a user slot, then a global slot; when a limit is full, the session
+ * is rejected at once if osg_admission_predict_wait() exceeds the maximum
+ * predicted wait, or else queues for at most the maximum wait.  Queue
+ * statistics are kept with osg_admission_stats_update() as sessions end,
+ * exactly as the server does.  Queued sessions are served first-come
+ * first-served; the server's polling makes the real order approximate.
+ *
+ * The replay is a discrete-event simulation, so days of logs take seconds.
+ *************************************************************************/
+
+typedef enum {
+    REPLAY_PENDING = 0,
+    REPLAY_WAIT_USER,
+    REPLAY_WAIT_GLOBAL,
+    REPLAY_ACTIVE,
+    REPLAY_DONE,
+    REPLAY_REJECTED,
+    REPLAY_TIMED_OUT
+} replay_state_t;
+
+// Departures sort before the other events at the same time, so a slot
+// freed at time t is available to a session arriving at t.
+typedef enum {
+    REPLAY_EVENT_DEPART = 0,
+    REPLAY_EVENT_USER_TIMEOUT,
+    REPLAY_EVENT_GLOBAL_TIMEOUT
+} replay_event_type_t;
+
+typedef struct {
+    double arrival;
+    double duration;  // Negative until filled in from the user's mean.
+    int user;
+} replay_session_t;
+
+// First-come first-served queue of session indexes.
+typedef struct {
+    int *items;
+    int head;
+    int len;
+    int size;
+    int waiting;  // Entries still waiting; others are skipped when popped.
+} replay_queue_t;
+
+typedef struct {
+    char *name;
+    int limit;
+    // Per-run state.
+    int active;
+    replay_queue_t queue;
+    osg_admission_stats_t stats;
+} replay_user_t;
+
+typedef struct {
+    double time;
+    int type;
+    int session;
+} replay_event_t;
+
+typedef struct {
+    double start;
+    long arrivals;
+    long admitted;
+    long rejected;
+    long timed_out;
+    double active_area;
+    int peak_active;
+    int peak_waiting;
+    double wait_total;
+    double wait_max;
+} replay_bucket_t;
+
+static replay_session_t *sessions = NULL;
+static int session_count = 0;
+static int session_size = 0;
+
+static replay_user_t *users = NULL;
+static int user_count = 0;
+static int user_size = 0;
+static int *user_table = NULL;
+static int user_table_size = 0;
+
+// Per-user limit overrides given with -U.
+static char **override_names = NULL;
+static int *override_limits = NULL;
+static int override_count = 0;
+
+// Per-run state.
+static replay_state_t *state = NULL;
+static double *admitted_at = NULL;
+static replay_event_t *heap = NULL;
+static int heap_len = 0;
+static int heap_size = 0;
+static replay_queue_t global_queue;
+static osg_admission_stats_t global_stats;
+static int global_active = 0;
+static int active = 0;
+static int waiting = 0;
+static double *waits = NULL;
+static long wait_count = 0;
+static long admitted_count = 0;
+static long rejected_count = 0;
+static long timed_out_count = 0;
+static double active_area = 0;
+static int peak_active = 0;
+static int peak_waiting = 0;
+
+static int global_limit = 0;
+static double max_wait = 0;
+static double max_predicted_wait = 0;
+
+// Time series.
+static double interval = 0;
+static replay_bucket_t bucket;
+static double clock_now = 0;
+
+
+static void *
+replay_realloc(void *ptr, size_t size)
+{
+    void *result = realloc(ptr, size ? size : 1);
+    if (!result) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return result;
+}
+
+
+/*************************************************************************
+ * Log parsing
+ *************************************************************************/
+
+static uint32_t
+replay_hash(const char *str)
+{
+    uint32_t hash = 2166136261u;
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+static int
+replay_user_lookup(const char *name)
+{
+    if (user_count * 2 >= user_table_size) {
+        int new_size = user_table_size ? user_table_size * 2 : 1024;
+        int *new_table = (int *)replay_realloc(NULL, new_size * sizeof(int));
+        memset(new_table, 0xff, new_size * sizeof(int));
+        int idx;
+        for (idx = 0; idx < user_count; idx++) {
+            uint32_t slot = replay_hash(users[idx].name) & (new_size - 1);
+            while (new_table[slot] != -1) {slot = (slot + 1) & (new_size - 1);}
+            new_table[slot] = idx;
+        }
+        free(user_table);
+        user_table = new_table;
+        user_table_size = new_size;
+    }
+    uint32_t slot = replay_hash(name) & (user_table_size - 1);
+    while (user_table[slot] != -1) {
+        if (!strcmp(users[user_table[slot]].name, name)) {return user_table[slot];}
+        slot = (slot + 1) & (user_table_size - 1);
+    }
+    if (user_count == user_size) {
+        user_size = user_size ? user_size * 2 : 256;
+        users = (replay_user_t *)replay_realloc(users, user_size * sizeof(replay_user_t));
+    }
+    memset(&users[user_count], '\0', sizeof(replay_user_t));
+    users[user_count].name = strdup(name);
+    if (!users[user_count].name) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    user_table[slot] = user_count;
+    return user_count++;
+}
+
+
+static void
+replay_add_session(double arrival, double duration, const char *user)
+{
+    if (session_count == session_size) {
+        session_size = session_size ? session_size * 2 : 4096;
+        sessions = (replay_session_t *)replay_realloc(sessions, session_size * sizeof(replay_session_t));
+    }
+    sessions[session_count].arrival = arrival;
+    sessions[session_count].duration = duration;
+    sessions[session_count].user = replay_user_lookup(user);
+    session_count++;
+}
+
+
+/*
+ * Copy the value of `key` (e.g., "USER=") in a transfer log record into
+ * `value`; returns 0 if it is not there.
+ */
+static int
+replay_field(const char *line, const char *key, char *value, size_t value_len)
+{
+    size_t key_len = strlen(key);
+    const char *ptr = line;
+    while ((ptr = strstr(ptr, key))) {
+        if ((ptr == line) || (ptr[-1] == ' ') || (ptr[-1] == '\t')) {break;}
+        ptr += key_len;
+    }
+    if (!ptr) {return 0;}
+    ptr += key_len;
+    size_t len = strcspn(ptr, " \t\r\n");
+    if (len >= value_len) {len = value_len - 1;}
+    memcpy(value, ptr, len);
+    value[len] = '\0';
+    return 1;
+}
+
+
+// Transfer log times look like 20261019123456.123456 (UTC).
+static int
+replay_parse_log_time(const char *value, double *result)
+{
+    struct tm tm;
+    memset(&tm, '\0', sizeof(tm));
+    int consumed = 0;
+    if (sscanf(value, "%4d%2d%2d%2d%2d%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &consumed) != 6)
+    {
+        return 0;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    *result = timegm(&tm);
+    if (value[consumed] == '.') {*result += strtod(value + consumed, NULL);}
+    return 1;
+}
+
+
+static void
+replay_parse_transfer(const char *line)
+{
+    char start_char[64], date_char[64], user[256];
+    double start, end;
+    if (!replay_field(line, "START=", start_char, sizeof(start_char)) ||
+        !replay_field(line, "DATE=", date_char, sizeof(date_char)) ||
+        !replay_field(line, "USER=", user, sizeof(user)) ||
+        !replay_parse_log_time(start_char, &start) ||
+        !replay_parse_log_time(date_char, &end))
+    {
+        return;
+    }
+    replay_add_session(start, end > start ? end - start : 0, user);
+}
+
+
+/*
+ * Server log lines look like
+ *   [1234] Mon Oct 19 12:34:56 2026 :: Rejecting transfer for alice due to ...
+ * with the time in the server's local time zone.
+ */
+static void
+replay_parse_refusal(const char *line, const char *message)
+{
+    const char *time_start = strchr(line, ']');
+    if (!time_start) {return;}
+    struct tm tm;
+    memset(&tm, '\0', sizeof(tm));
+    if (!strptime(time_start + 1, " %a %b %d %H:%M:%S %Y", &tm)) {return;}
+    tm.tm_isdst = -1;
+    time_t when = mktime(&tm);
+
+    const char *user_start = strstr(message, " for ") + 5;
+    const char *user_end = strstr(user_start, " due to ");
+    if (!user_end || (user_end - user_start >= 256)) {return;}
+    char user[256];
+    memcpy(user, user_start, user_end - user_start);
+    user[user_end - user_start] = '\0';
+    // Sessions which timed out are logged at the end of their wait; the
+    // replay assumes the same maximum wait (-w) throughout.
+    if (message[3] == 'F') {when -= max_wait;}
+    replay_add_session(when, -1, user);
+}
+
+
+static void
+replay_parse_line(const char *line)
+{
+    const char *message;
+    if (strstr(line, "START=") && strstr(line, "DATE=")) {
+        replay_parse_transfer(line);
+    } else if ((message = strstr(line, ":: Rejecting transfer for ")) ||
+               (message = strstr(line, ":: Failing transfer for ")))
+    {
+        replay_parse_refusal(line, message);
+    }
+}
+
+
+static int
+replay_read(const char *filename)
+{
+    FILE *fp = strcmp(filename, "-") ? fopen(filename, "r") : stdin;
+    if (!fp) {
+        perror(filename);
+        return -1;
+    }
+    char *line = NULL;
+    size_t line_len = 0;
+    while (getline(&line, &line_len, fp) != -1) {
+        replay_parse_line(line);
+    }
+    free(line);
+    if (fp != stdin) {fclose(fp);}
+    return 0;
+}
+
+
+static int
+replay_session_cmp(const void *left_ptr, const void *right_ptr)
+{
+    const replay_session_t *left = (const replay_session_t *)left_ptr;
+    const replay_session_t *right = (const replay_session_t *)right_ptr;
+    if (left->arrival < right->arrival) {return -1;}
+    if (left->arrival > right->arrival) {return 1;}
+    return 0;
+}
+
+
+/*
+ * Sort arrivals and give refused sessions, which have no recorded
+ * duration, their user's mean duration (or the overall mean).
+ */
+static void
+replay_prepare(void)
+{
+    qsort(sessions, session_count, sizeof(replay_session_t), replay_session_cmp);
+
+    double *total = (double *)replay_realloc(NULL, user_count * sizeof(double));
+    long *count = (long *)replay_realloc(NULL, user_count * sizeof(long));
+    memset(total, '\0', user_count * sizeof(double));
+    memset(count, '\0', user_count * sizeof(long));
+    double overall_total = 0;
+    long overall_count = 0;
+    int idx;
+    for (idx = 0; idx < session_count; idx++) {
+        if (sessions[idx].duration < 0) {continue;}
+        total[sessions[idx].user] += sessions[idx].duration;
+        count[sessions[idx].user]++;
+        overall_total += sessions[idx].duration;
+        overall_count++;
+    }
+    double overall_mean = overall_count ? overall_total / overall_count : 0;
+    for (idx = 0; idx < session_count; idx++) {
+        if (sessions[idx].duration >= 0) {continue;}
+        int user = sessions[idx].user;
+        sessions[idx].duration = count[user] ? total[user] / count[user] : overall_mean;
+    }
+    free(total);
+    free(count);
+}
+
+
+/*************************************************************************
+ * Simulation
+ *************************************************************************/
+
+static void
+replay_heap_push(double time, int type, int session)
+{
+    if (heap_len == heap_size) {
+        heap_size = heap_size ? heap_size * 2 : 4096;
+        heap = (replay_event_t *)replay_realloc(heap, heap_size * sizeof(replay_event_t));
+    }
+    int idx = heap_len++;
+    while (idx) {
+        int parent = (idx - 1) / 2;
+        if ((heap[parent].time < time) || ((heap[parent].time == time) && (heap[parent].type <= type))) {break;}
+        heap[idx] = heap[parent];
+        idx = parent;
+    }
+    heap[idx].time = time;
+    heap[idx].type = type;
+    heap[idx].session = session;
+}
+
+
+static replay_event_t
+replay_heap_pop(void)
+{
+    replay_event_t top = heap[0];
+    replay_event_t last = heap[--heap_len];
+    int idx = 0;
+    while (1) {
+        int child = 2 * idx + 1;
+        if (child >= heap_len) {break;}
+        if ((child + 1 < heap_len) &&
+            ((heap[child + 1].time < heap[child].time) ||
+             ((heap[child + 1].time == heap[child].time) && (heap[child + 1].type < heap[child].type))))
+        {
+            child++;
+        }
+        if ((last.time < heap[child].time) || ((last.time == heap[child].time) && (last.type <= heap[child].type))) {break;}
+        heap[idx] = heap[child];
+        idx = child;
+    }
+    heap[idx] = last;
+    return top;
+}
+
+
+static void
+replay_queue_push(replay_queue_t *queue, int session)
+{
+    if (queue->head + queue->len == queue->size) {
+        if (queue->head) {
+            memmove(queue->items, queue->items + queue->head, queue->len * sizeof(int));
+            queue->head = 0;
+        }
+        if (queue->len == queue->size) {
+            queue->size = queue->size ? queue->size * 2 : 64;
+            queue->items = (int *)replay_realloc(queue->items, queue->size * sizeof(int));
+        }
+    }
+    queue->items[queue->head + queue->len++] = session;
+    queue->waiting++;
+}
+
+
+/*
+ * The first session in `queue` still in `wait_state`, or -1; sessions
+ * which have since timed out are dropped on the way.
+ */
+static int
+replay_queue_pop(replay_queue_t *queue, replay_state_t wait_state)
+{
+    while (queue->len) {
+        int session = queue->items[queue->head++];
+        queue->len--;
+        if (state[session] == wait_state) {
+            queue->waiting--;
+            return session;
+        }
+    }
+    queue->head = 0;
+    return -1;
+}
+
+
+static void
+replay_queue_reset(replay_queue_t *queue)
+{
+    queue->head = 0;
+    queue->len = 0;
+    queue->waiting = 0;
+}
+
+
+static void
+replay_bucket_print(void)
+{
+    char when[64];
+    time_t start = (time_t)bucket.start;
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", gmtime(&start));
+    printf("  %s %8ld %8ld %8ld %8ld %8.1f %8d %8d %8.1f %8.1f\n",
+           when, bucket.arrivals, bucket.admitted, bucket.rejected, bucket.timed_out,
+           bucket.active_area / interval, bucket.peak_active, bucket.peak_waiting,
+           bucket.admitted ? bucket.wait_total / bucket.admitted : 0, bucket.wait_max);
+}
+
+
+static void
+replay_bucket_reset(double start)
+{
+    memset(&bucket, '\0', sizeof(bucket));
+    bucket.start = start;
+    bucket.peak_active = active;
+    bucket.peak_waiting = waiting;
+}
+
+
+/*
+ * Move the simulation clock to `now`, accounting for the concurrency in
+ * between and printing any completed time-series intervals.
+ */
+static void
+replay_advance(double now)
+{
+    if (now <= clock_now) {return;}
+    active_area += active * (now - clock_now);
+    if (interval > 0) {
+        while (now >= bucket.start + interval) {
+            bucket.active_area += active * (bucket.start + interval - clock_now);
+            clock_now = bucket.start + interval;
+            replay_bucket_print();
+            replay_bucket_reset(clock_now);
+        }
+        bucket.active_area += active * (now - clock_now);
+    }
+    clock_now = now;
+}
+
+
+static void
+replay_note_counts(void)
+{
+    if (active > peak_active) {peak_active = active;}
+    if (waiting > peak_waiting) {peak_waiting = waiting;}
+    if (active > bucket.peak_active) {bucket.peak_active = active;}
+    if (waiting > bucket.peak_waiting) {bucket.peak_waiting = waiting;}
+}
+
+
+static void
+replay_admit(int session, double now)
+{
+    double wait = now - sessions[session].arrival;
+    state[session] = REPLAY_ACTIVE;
+    admitted_at[session] = now;
+    active++;
+    admitted_count++;
+    bucket.admitted++;
+    bucket.wait_total += wait;
+    if (wait > bucket.wait_max) {bucket.wait_max = wait;}
+    if (wait > 0) {waits[wait_count++] = wait;}
+    replay_heap_push(now + sessions[session].duration, REPLAY_EVENT_DEPART, session);
+    replay_note_counts();
+}
+
+
+static void
+replay_refuse(int session, replay_state_t outcome)
+{
+    state[session] = outcome;
+    if (outcome == REPLAY_REJECTED) {
+        rejected_count++;
+        bucket.rejected++;
+    } else {
+        timed_out_count++;
+        bucket.timed_out++;
+    }
+}
+
+
+static void
+replay_wait(int session, double now, replay_queue_t *queue, replay_state_t wait_state)
+{
+    state[session] = wait_state;
+    replay_queue_push(queue, session);
+    waiting++;
+    replay_heap_push(now + max_wait,
+                     wait_state == REPLAY_WAIT_USER ? REPLAY_EVENT_USER_TIMEOUT : REPLAY_EVENT_GLOBAL_TIMEOUT,
+                     session);
+    replay_note_counts();
+}
+
+
+/*
+ * Second half of check_connection_limits(): take a global slot, queue for
+ * one, or be rejected.  Returns 0 if the session was rejected.
+ */
+static int
+replay_stage_global(int session, double now)
+{
+    if (global_limit <= 0) {
+        replay_admit(session, now);
+        return 1;
+    }
+    if (global_active < global_limit) {
+        global_active++;
+        replay_admit(session, now);
+        return 1;
+    }
+    if ((max_predicted_wait >= 0) &&
+        (osg_admission_predict_wait(&global_stats, global_limit, global_queue.waiting) > max_predicted_wait))
+    {
+        replay_refuse(session, REPLAY_REJECTED);
+        return 0;
+    }
+    replay_wait(session, now, &global_queue, REPLAY_WAIT_GLOBAL);
+    return 1;
+}
+
+
+/*
+ * Hand free slots of `user` to its queued sessions, which go on to the
+ * global limit.
+ */
+static void
+replay_grant_user(replay_user_t *user, double now)
+{
+    while (user->active < user->limit) {
+        int session = replay_queue_pop(&user->queue, REPLAY_WAIT_USER);
+        if (session == -1) {break;}
+        waiting--;
+        user->active++;
+        if (!replay_stage_global(session, now)) {user->active--;}
+    }
+}
+
+
+static void
+replay_grant_global(double now)
+{
+    while (global_active < global_limit) {
+        int session = replay_queue_pop(&global_queue, REPLAY_WAIT_GLOBAL);
+        if (session == -1) {break;}
+        waiting--;
+        global_active++;
+        replay_admit(session, now);
+    }
+}
+
+
+static void
+replay_arrive(int session, double now)
+{
+    replay_user_t *user = &users[sessions[session].user];
+    bucket.arrivals++;
+    if (user->limit <= 0) {
+        replay_stage_global(session, now);
+        return;
+    }
+    if (user->active < user->limit) {
+        user->active++;
+        if (!replay_stage_global(session, now)) {
+            user->active--;
+            replay_grant_user(user, now);
+        }
+        return;
+    }
+    if ((max_predicted_wait >= 0) &&
+        (osg_admission_predict_wait(&user->stats, user->limit, user->queue.waiting) > max_predicted_wait))
+    {
+        replay_refuse(session, REPLAY_REJECTED);
+        return;
+    }
+    replay_wait(session, now, &user->queue, REPLAY_WAIT_USER);
+}
+
+
+static void
+replay_event(replay_event_t *event)
+{
+    int session = event->session;
+    replay_user_t *user = &users[sessions[session].user];
+    switch (event->type) {
+    case REPLAY_EVENT_DEPART:
+        state[session] = REPLAY_DONE;
+        active--;
+        // As in the server, statistics cover only the slots held and are
+        // updated when the session exits.
+        if (global_limit > 0) {
+            global_active--;
+            osg_admission_stats_update(&global_stats, event->time - admitted_at[session], event->time);
+        }
+        if (user->limit > 0) {
+            user->active--;
+            osg_admission_stats_update(&user->stats, event->time - admitted_at[session], event->time);
+        }
+        replay_grant_global(event->time);
+        if (user->limit > 0) {replay_grant_user(user, event->time);}
+        break;
+    case REPLAY_EVENT_USER_TIMEOUT:
+        if (state[session] != REPLAY_WAIT_USER) {break;}
+        replay_refuse(session, REPLAY_TIMED_OUT);
+        user->queue.waiting--;
+        waiting--;
+        break;
+    case REPLAY_EVENT_GLOBAL_TIMEOUT:
+        if (state[session] != REPLAY_WAIT_GLOBAL) {break;}
+        replay_refuse(session, REPLAY_TIMED_OUT);
+        global_queue.waiting--;
+        waiting--;
+        // The user slot was held while waiting for a global one.
+        if (user->limit > 0) {
+            user->active--;
+            replay_grant_user(user, event->time);
+        }
+        break;
+    }
+}
+
+
+static int
+replay_double_cmp(const void *left_ptr, const void *right_ptr)
+{
+    double left = *(const double *)left_ptr;
+    double right = *(const double *)right_ptr;
+    return (left > right) - (left < right);
+}
+
+
+/*
+ * Wait below which `fraction` of the admitted sessions fall; the sessions
+ * not in `waits` were admitted without waiting.
+ */
+static double
+replay_percentile(double fraction)
+{
+    long rank = (long)(fraction * admitted_count);
+    long zero_waits = admitted_count - wait_count;
+    if (rank < zero_waits) {return 0;}
+    rank -= zero_waits;
+    if (rank >= wait_count) {rank = wait_count - 1;}
+    return rank >= 0 ? waits[rank] : 0;
+}
+
+
+static int
+replay_user_limit(const char *name, int default_limit)
+{
+    int idx;
+    for (idx = 0; idx < override_count; idx++) {
+        if (!strcmp(override_names[idx], name)) {return override_limits[idx];}
+    }
+    // Same per-user settings as get_connection_limits_params().
+    char specific_limit_env_var[256];
+    snprintf(specific_limit_env_var, 255, "GRIDFTP_%s_USER_TRANSFER_LIMIT", name);
+    specific_limit_env_var[255] = '\0';
+    for (idx = 0; specific_limit_env_var[idx]; idx++) {
+        specific_limit_env_var[idx] = toupper(specific_limit_env_var[idx]);
+    }
+    const char *specific_limit_char = getenv(specific_limit_env_var);
+    return specific_limit_char ? atoi(specific_limit_char) : default_limit;
+}
+
+
+static void
+replay_run(int candidate_global_limit, int default_user_limit)
+{
+    global_limit = candidate_global_limit;
+    int idx;
+    for (idx = 0; idx < user_count; idx++) {
+        users[idx].limit = replay_user_limit(users[idx].name, default_user_limit);
+        users[idx].active = 0;
+        replay_queue_reset(&users[idx].queue);
+        memset(&users[idx].stats, '\0', sizeof(osg_admission_stats_t));
+    }
+    memset(state, '\0', session_count * sizeof(replay_state_t));
+    replay_queue_reset(&global_queue);
+    memset(&global_stats, '\0', sizeof(global_stats));
+    heap_len = 0;
+    global_active = 0;
+    active = waiting = 0;
+    wait_count = admitted_count = rejected_count = timed_out_count = 0;
+    active_area = 0;
+    peak_active = peak_waiting = 0;
+
+    char predicted_char[32];
+    if (max_predicted_wait >= 0) {
+        snprintf(predicted_char, sizeof(predicted_char), "%.0fs", max_predicted_wait);
+    } else {
+        strcpy(predicted_char, "off");
+    }
+    printf("Global limit %d, default user limit %d, maximum wait %.0fs, maximum predicted wait %s\n",
+           global_limit, default_user_limit, max_wait, predicted_char);
+    double start = session_count ? sessions[0].arrival : 0;
+    clock_now = start;
+    replay_bucket_reset(start);
+    if (interval > 0) {
+        printf("  %-19s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "interval (UTC)", "arrived", "admitted",
+               "rejected", "timedout", "mean act", "peak act", "peak q", "mean wt", "max wt");
+    }
+
+    int next = 0;
+    while ((next < session_count) || heap_len) {
+        if (heap_len && ((next == session_count) || (heap[0].time <= sessions[next].arrival))) {
+            replay_event_t event = replay_heap_pop();
+            replay_advance(event.time);
+            replay_event(&event);
+        } else {
+            replay_advance(sessions[next].arrival);
+            replay_arrive(next, sessions[next].arrival);
+            next++;
+        }
+    }
+    if ((interval > 0) && session_count) {replay_bucket_print();}
+
+    qsort(waits, wait_count, sizeof(double), replay_double_cmp);
+    double span = clock_now - start;
+    printf("  %d sessions: %ld admitted (%ld after queueing), %ld rejected early, %ld timed out\n",
+           session_count, admitted_count, wait_count, rejected_count, timed_out_count);
+    printf("  wait of admitted sessions: median %.1fs, 95th percentile %.1fs, 99th percentile %.1fs, max %.1fs\n",
+           replay_percentile(0.5), replay_percentile(0.95), replay_percentile(0.99),
+           wait_count ? waits[wait_count - 1] : 0);
+    printf("  concurrency: mean %.1f, peak %d; peak queue %d\n\n",
+           span > 0 ? active_area / span : 0, peak_active, peak_waiting);
+}
+
+
+/*
+ * Parse a comma-separated list of limits into `limits`; returns the count.
+ */
+static int
+replay_parse_limits(const char *value, int **limits)
+{
+    int count = 0;
+    const char *ptr = value;
+    while (1) {
+        *limits = (int *)replay_realloc(*limits, (count + 1) * sizeof(int));
+        char *end;
+        (*limits)[count++] = strtol(ptr, &end, 10);
+        if (end == ptr) {return -1;}
+        if (*end != ',') {return *end ? -1 : count;}
+        ptr = end + 1;
+    }
+}
+
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [-g LIMIT[,LIMIT...]] [-u LIMIT[,LIMIT...]] [-U USER=LIMIT] [-w SECS] [-p SECS] [-i SECS] [LOG...]\n"
+        "Replay transfer logs and OSG admission log lines against candidate transfer limits.\n"
+        "  -g  global transfer limits to try (default: $GRIDFTP_TRANSFER_LIMIT, or none)\n"
+        "  -u  default per-user limits to try (default: $GRIDFTP_DEFAULT_USER_TRANSFER_LIMIT, or none)\n"
+        "  -U  limit for one user (default: $GRIDFTP_<USER>_USER_TRANSFER_LIMIT); may be repeated\n"
+        "  -w  maximum queue wait (default: $OSG_QUEUE_MAX_WAIT, or 60)\n"
+        "  -p  maximum predicted wait; -1 for none (default: $OSG_QUEUE_MAX_PREDICTED_WAIT, or none)\n"
+        "  -i  also report each interval of this many seconds\n"
+        "Logs are read from standard input if none are given.\n",
+        prog);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int *global_limits = NULL, *user_limits = NULL;
+    int global_limit_count = 0, user_limit_count = 0;
+    const char *value;
+
+    max_wait = osg_admission_max_wait();
+    int predicted_given = 0;
+    global_limits = (int *)replay_realloc(NULL, sizeof(int));
+    global_limits[0] = (value = getenv("GRIDFTP_TRANSFER_LIMIT")) ? atoi(value) : -1;
+    global_limit_count = 1;
+    user_limits = (int *)replay_realloc(NULL, sizeof(int));
+    user_limits[0] = (value = getenv("GRIDFTP_DEFAULT_USER_TRANSFER_LIMIT")) ? atoi(value) : -1;
+    user_limit_count = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:u:U:w:p:i:h")) != -1) {
+        char *sep;
+        switch (opt) {
+        case 'g':
+            if ((global_limit_count = replay_parse_limits(optarg, &global_limits)) == -1) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'u':
+            if ((user_limit_count = replay_parse_limits(optarg, &user_limits)) == -1) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'U':
+            if (!(sep = strrchr(optarg, '='))) {
+                usage(argv[0]);
+                return 2;
+            }
+            *sep = '\0';
+            override_names = (char **)replay_realloc(override_names, (override_count + 1) * sizeof(char *));
+            override_limits = (int *)replay_realloc(override_limits, (override_count + 1) * sizeof(int));
+            override_names[override_count] = optarg;
+            override_limits[override_count++] = atoi(sep + 1);
+            break;
+        case 'w':
+            max_wait = atof(optarg);
+            break;
+        case 'p':
+            max_predicted_wait = atof(optarg);
+            predicted_given = 1;
+            break;
+        case 'i':
+            interval = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (!predicted_given) {max_predicted_wait = osg_admission_max_predicted_wait();}
+
+    if (optind == argc) {
+        if (replay_read("-")) {return 1;}
+    }
+    for (; optind < argc; optind++) {
+        if (replay_read(argv[optind])) {return 1;}
+    }
+    replay_prepare();
+
+    state = (replay_state_t *)replay_realloc(NULL, session_count * sizeof(replay_state_t));
+    admitted_at = (double *)replay_realloc(NULL, session_count * sizeof(double));
+    waits = (double *)replay_realloc(NULL, session_count * sizeof(double));
+
+    int gidx, uidx;
+    for (gidx = 0; gidx < global_limit_count; gidx++) {
+        for (uidx = 0; uidx < user_limit_count; uidx++) {
+            replay_run(global_limits[gidx], user_limits[uidx]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,334 @@
+
+#include "osg_extensions.h"
+
+#include <string.h>
+#include <sys/file.h>
+
+/*************************************************************************
+ * Admission queue prediction
+ * --------------------------
+ * When every transfer slot of a limit is taken, a new session would wait
+ * (up to OSG_QUEUE_MAX_WAIT seconds, default 60) for one to be released.
+ * Rather than wait blindly, it estimates how long it would take:
+ *
+ *  - Each limit keeps statistics next to its semaphore (`<sem>.stats`):
+ *    moving averages of how long sessions hold a slot and of the time
+ *    between slot releases.  After them, the file records when each slot
+ *    was taken.  A session records its release when it ends and drops its
+ *    slot (osg_admission_release()).  A session that crashed, was killed,
+ *    or otherwise never got there leaves its record behind with its slot
+ *    lock gone; the next session to take or release a slot of the limit
+ *    counts that release, without a hold time since it cannot tell when it
+ *    happened.
+ *  - Sessions queued for a limit hold a byte-range lock in a separate
+ *    region of the semaphore file, so the number of sessions already
+ *    waiting can be counted (and disappears with a crashed process).
+ *
+ * A new waiter needs one release per session ahead of it, plus one; the
+ * release rate is the faster of the observed rate and the rate implied by
+ * `limit` slots each held for the average time.  If OSG_QUEUE_MAX_PREDICTED_WAIT
+ * is set and the estimate exceeds it, the session is rejected at once with
+ * the estimate as a retry-after hint.  No estimate is made until
+ * OSG_ADMISSION_MIN_RELEASES sessions have released a slot of the limit.
+ *
+ * The model itself (osg_admission_predict_wait() and
+ * osg_admission_stats_update()) does not touch any shared state, so the
+ * replay tool can use exactly the same logic.
+ *************************************************************************/
+
+#define OSG_ADMISSION_STATS_MAGIC 0x4f534751  // "OSGQ"
+#define OSG_ADMISSION_DEFAULT_MAX_WAIT 60
+// Weight of the newest sample in the moving averages.
+#define OSG_ADMISSION_EWMA_WEIGHT 0.1
+// Releases further apart than this say nothing about a busy server.
+#define OSG_ADMISSION_MAX_INTERVAL 3600.0
+// Releases needed before the averages are trusted.
+#define OSG_ADMISSION_MIN_RELEASES 10
+// Waiter locks live well past the slot bytes used by the semaphore.
+#define OSG_ADMISSION_WAITER_BASE (1 << 20)
+#define OSG_ADMISSION_MAX_WAITERS 1024
+
+// Slots held by this process, until osg_admission_release().
+typedef struct {
+    char sem_name[256];
+    mode_t mode;
+    int fd;
+    int slot;
+    int limit;
+} osg_admission_held_t;
+
+static osg_admission_held_t osg_admission_held[2];
+static double osg_admission_acquired_at;
+static int osg_admission_held_count = 0;
+
+
+static double
+admission_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+int
+osg_admission_max_wait(void)
+{
+    const char *wait_char = getenv("OSG_QUEUE_MAX_WAIT");
+    if (wait_char && (atoi(wait_char) >= 0)) {return atoi(wait_char);}
+    return OSG_ADMISSION_DEFAULT_MAX_WAIT;
+}
+
+
+int
+osg_admission_max_predicted_wait(void)
+{
+    const char *wait_char = getenv("OSG_QUEUE_MAX_PREDICTED_WAIT");
+    if (wait_char && (atoi(wait_char) >= 0)) {return atoi(wait_char);}
+    return -1;
+}
+
+
+/*
+ * Fold a slot held for `hold_secs` and released at `now` (seconds on any
+ * clock shared by all callers) into `stats`.  A negative `hold_secs` means
+ * the hold time is unknown and leaves its average alone.
+ */
+void
+osg_admission_stats_update(osg_admission_stats_t *stats, double hold_secs, double now)
+{
+    if (stats->magic != OSG_ADMISSION_STATS_MAGIC) {
+        memset(stats, '\0', sizeof(*stats));
+        stats->magic = OSG_ADMISSION_STATS_MAGIC;
+    }
+    if (hold_secs >= 0) {
+        stats->mean_hold = stats->mean_hold > 0 ?
+            stats->mean_hold + OSG_ADMISSION_EWMA_WEIGHT * (hold_secs - stats->mean_hold) : hold_secs;
+    }
+
+    double interval = now - stats->last_release;
+    if (stats->releases && (interval >= 0) && (interval < OSG_ADMISSION_MAX_INTERVAL)) {
+        stats->mean_interval = stats->mean_interval > 0 ?
+            stats->mean_interval + OSG_ADMISSION_EWMA_WEIGHT * (interval - stats->mean_interval) : interval;
+    }
+    stats->last_release = now;
+    stats->releases++;
+}
+
+
+/*
+ * Expected seconds until a new waiter gets one of `limit` busy slots, with
+ * `waiters_ahead` sessions already queued.  Returns 0 if there is not yet
+ * enough history to say.
+ */
+double
+osg_admission_predict_wait(const osg_admission_stats_t *stats, int limit, int waiters_ahead)
+{
+    if ((stats->magic != OSG_ADMISSION_STATS_MAGIC) || (limit <= 0) ||
+        (stats->releases < OSG_ADMISSION_MIN_RELEASES))
+    {
+        return 0;
+    }
+
+    double rate = 0;
+    if (stats->mean_hold > 0) {rate = limit / stats->mean_hold;}
+    if ((stats->mean_interval > 0) && (1 / stats->mean_interval > rate)) {rate = 1 / stats->mean_interval;}
+    if (rate <= 0) {return 0;}
+    return (waiters_ahead + 1) / rate;
+}
+
+
+static void
+admission_stats_name(const char *sem_name, char *stats_name, size_t stats_len)
+{
+    snprintf(stats_name, stats_len, "%s.stats", sem_name);
+    stats_name[stats_len-1] = '\0';
+}
+
+
+double
+osg_admission_estimate(const char *sem_name, int limit, int waiters_ahead)
+{
+    char stats_name[300];
+    admission_stats_name(sem_name, stats_name, sizeof(stats_name));
+    int fd = open(stats_name, O_RDONLY);
+    if (fd == -1) {return 0;}
+    osg_admission_stats_t stats;
+    memset(&stats, '\0', sizeof(stats));
+    flock(fd, LOCK_SH);
+    ssize_t nread = pread(fd, &stats, sizeof(stats), 0);
+    flock(fd, LOCK_UN);
+    close(fd);
+    if (nread != sizeof(stats)) {return 0;}
+    return osg_admission_predict_wait(&stats, limit, waiters_ahead);
+}
+
+
+static void
+admission_unlock_slot(const osg_admission_held_t *held)
+{
+    struct flock lock;
+    memset(&lock, '\0', sizeof(lock));
+    lock.l_type = F_UNLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = held->slot;
+    lock.l_len = 1;
+    fcntl(held->fd, F_SETLK, &lock);
+}
+
+
+static off_t
+holder_offset(int slot)
+{
+    return sizeof(osg_admission_stats_t) + slot * sizeof(double);
+}
+
+
+/*
+ * Count the releases of slots whose holder left without recording them:
+ * the slot is free but its record is still set.  `held` is this
+ * process's own slot, which looks free to F_GETLK; a record found there
+ * belongs to the previous holder unless `own` is set.  Must be called with
+ * the statistics locked.
+ */
+static void
+admission_collect(int stats_fd, osg_admission_stats_t *stats, const osg_admission_held_t *held, int own, double now)
+{
+    int slot;
+    for (slot = 0; slot < held->limit; slot++) {
+        double acquired = 0;
+        if ((pread(stats_fd, &acquired, sizeof(acquired), holder_offset(slot)) != sizeof(acquired)) ||
+            (acquired <= 0))
+        {
+            continue;
+        }
+        if (slot == held->slot) {
+            if (own) {continue;}
+        } else {
+            struct flock lock;
+            memset(&lock, '\0', sizeof(lock));
+            lock.l_type = F_WRLCK;
+            lock.l_whence = SEEK_SET;
+            lock.l_start = slot;
+            lock.l_len = 1;
+            if ((fcntl(held->fd, F_GETLK, &lock) == -1) || (lock.l_type != F_UNLCK)) {continue;}
+        }
+        osg_admission_stats_update(stats, -1, now);
+        acquired = 0;
+        pwrite(stats_fd, &acquired, sizeof(acquired), holder_offset(slot));
+    }
+}
+
+
+/*
+ * Update the statistics of `held`, locked: collect abandoned slots, then
+ * either set this process's record (`release` false) or fold its hold
+ * time in, clear the record, and drop the slot.
+ */
+static void
+admission_update(const osg_admission_held_t *held, globus_bool_t release)
+{
+    char stats_name[300];
+    admission_stats_name(held->sem_name, stats_name, sizeof(stats_name));
+    int fd = open(stats_name, O_RDWR | O_CREAT, held->mode);
+    if (fd == -1) {
+        if (release) {admission_unlock_slot(held);}
+        return;
+    }
+    fchmod(fd, held->mode);
+    osg_admission_stats_t stats;
+    memset(&stats, '\0', sizeof(stats));
+    flock(fd, LOCK_EX);
+    if (pread(fd, &stats, sizeof(stats), 0) != sizeof(stats)) {memset(&stats, '\0', sizeof(stats));}
+    double now = admission_now();
+    admission_collect(fd, &stats, held, release, now);
+    double acquired = release ? 0 : now;
+    if (release) {osg_admission_stats_update(&stats, now - osg_admission_acquired_at, now);}
+    pwrite(fd, &acquired, sizeof(acquired), holder_offset(held->slot));
+    pwrite(fd, &stats, sizeof(stats), 0);
+    // Drop the slot before the statistics, so whoever takes it next finds
+    // the record already cleared.
+    if (release) {admission_unlock_slot(held);}
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+
+/*
+ * Note that this process holds slot `slot` of the `limit`-slot semaphore
+ * `sem_name`, open on `fd`; its statistics are created with the
+ * semaphore's `mode`.
+ */
+void
+osg_admission_acquired(const char *sem_name, mode_t mode, int fd, int slot, int limit)
+{
+    if (osg_admission_held_count == 2) {return;}
+    if (!osg_admission_held_count) {osg_admission_acquired_at = admission_now();}
+    osg_admission_held_t *held = &osg_admission_held[osg_admission_held_count];
+    strncpy(held->sem_name, sem_name, 255);
+    held->sem_name[255] = '\0';
+    held->mode = mode;
+    held->fd = fd;
+    held->slot = slot;
+    held->limit = limit;
+    osg_admission_held_count++;
+    admission_update(held, GLOBUS_FALSE);
+}
+
+
+void
+osg_admission_release(void)
+{
+    int idx;
+    for (idx = 0; idx < osg_admission_held_count; idx++) {
+        admission_update(&osg_admission_held[idx], GLOBUS_TRUE);
+    }
+    osg_admission_held_count = 0;
+}
+
+
+static void
+waiter_lock_init(struct flock *lock, short type, int waiter)
+{
+    memset(lock, '\0', sizeof(*lock));
+    lock->l_type = type;
+    lock->l_whence = SEEK_SET;
+    lock->l_start = OSG_ADMISSION_WAITER_BASE + waiter;
+    lock->l_len = 1;
+}
+
+
+/*
+ * Join the queue of semaphore `fd`.  Returns this process's waiter index
+ * (or -1 if the queue is full) and sets `waiters_ahead` to the number of
+ * sessions already queued.
+ */
+int
+osg_admission_waiter_join(int fd, int *waiters_ahead)
+{
+    int waiter = -1;
+    int others = 0;
+    int idx;
+    for (idx = 0; idx < OSG_ADMISSION_MAX_WAITERS; idx++) {
+        struct flock lock;
+        waiter_lock_init(&lock, F_WRLCK, idx);
+        if ((waiter == -1) && (fcntl(fd, F_SETLK, &lock) == 0)) {
+            waiter = idx;
+            continue;
+        }
+        waiter_lock_init(&lock, F_WRLCK, idx);
+        if ((fcntl(fd, F_GETLK, &lock) == 0) && (lock.l_type != F_UNLCK)) {others++;}
+    }
+    *waiters_ahead = others;
+    return waiter;
+}
+
+
+void
+osg_admission_waiter_leave(int fd, int waiter)
+{
+    if (waiter < 0) {return;}
+    struct flock lock;
+    waiter_lock_init(&lock, F_UNLCK, waiter);
+    fcntl(fd, F_SETLK, &lock);
+}
@@ -0,0 +1,115 @@
+
+#include "osg_extensions.h"
+
+#include <pthread.h>
+
+/*************************************************************************
+ * Buffer pool
+ * -----------
+ * Per-process pool of page-aligned data buffers.  Each session is its own
+ * process, so the pool is shared by all transfers within a session and
+ * buffers are reused from one block (and one file) to the next instead of
+ * being allocated and freed for every read.
+ *
+ * The pool holds buffers of a few sizes - the first sizes requested,
+ * normally the session block size and the small-file buffer size (see
+ * osg_send.c).  Buffers of any other size bypass the pool.
+ *************************************************************************/
+
+#define OSG_BUFFER_ALIGNMENT 4096
+#define OSG_BUFFER_POOL_DEFAULT_MAX 64
+#define OSG_BUFFER_POOL_CLASSES 4
+
+typedef struct osg_buffer_s {
+    struct osg_buffer_s *next;
+} osg_buffer_t;
+
+typedef struct {
+    globus_size_t size;
+    osg_buffer_t *free;
+    int count;
+} osg_buffer_class_t;
+
+// A pthread mutex: buffers may be taken and returned outside Globus threads.
+static pthread_mutex_t osg_buffer_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static globus_bool_t osg_buffer_pool_initialized = GLOBUS_FALSE;
+static osg_buffer_class_t osg_buffer_pool[OSG_BUFFER_POOL_CLASSES];
+static int osg_buffer_pool_max = OSG_BUFFER_POOL_DEFAULT_MAX;
+
+
+/*
+ * The size class for `size`, claiming a free one if needed; NULL if all
+ * classes are taken by other sizes.  Must be called with the pool locked.
+ */
+static osg_buffer_class_t *
+osg_buffer_class(globus_size_t size)
+{
+    int idx;
+    for (idx = 0; idx < OSG_BUFFER_POOL_CLASSES; idx++) {
+        if (osg_buffer_pool[idx].size == size) {return &osg_buffer_pool[idx];}
+        if (!osg_buffer_pool[idx].size) {
+            osg_buffer_pool[idx].size = size;
+            return &osg_buffer_pool[idx];
+        }
+    }
+    return NULL;
+}
+
+
+void
+osg_buffer_pool_init(void)
+{
+    if (osg_buffer_pool_initialized) {return;}
+
+    const char *max_char = getenv("OSG_BUFFER_POOL_MAX");
+    if (max_char) {
+        osg_buffer_pool_max = atoi(max_char);
+    }
+    osg_buffer_pool_initialized = GLOBUS_TRUE;
+}
+
+
+globus_byte_t *
+osg_buffer_get(globus_size_t size)
+{
+    void *buffer = NULL;
+
+    pthread_mutex_lock(&osg_buffer_pool_mutex);
+    {
+        osg_buffer_class_t *pool = osg_buffer_class(size);
+        if (pool && pool->free) {
+            buffer = pool->free;
+            pool->free = pool->free->next;
+            pool->count--;
+        }
+    }
+    pthread_mutex_unlock(&osg_buffer_pool_mutex);
+
+    if (!buffer && posix_memalign(&buffer, OSG_BUFFER_ALIGNMENT, size ? size : 1)) {
+        buffer = NULL;
+    }
+    return (globus_byte_t *)buffer;
+}
+
+
+void
+osg_buffer_put(globus_byte_t *buffer, globus_size_t size)
+{
+    if (!buffer) {return;}
+
+    pthread_mutex_lock(&osg_buffer_pool_mutex);
+    {
+        osg_buffer_class_t *pool = osg_buffer_class(size);
+        if (pool && (size >= sizeof(osg_buffer_t)) && (pool->count < osg_buffer_pool_max))
+        {
+            osg_buffer_t *entry = (osg_buffer_t *)buffer;
+            entry->next = pool->free;
+            pool->free = entry;
+            pool->count++;
+            buffer = NULL;
+        }
+    }
+    pthread_mutex_unlock(&osg_buffer_pool_mutex);
+
+    if (buffer) {free(buffer);}
+}
@@ -0,0 +1,419 @@
+
+#include "osg_extensions.h"
+
+#include <ctype.h>
+#include <poll.h>
+#include <pwd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+/*************************************************************************
+ * cgroup v2 session placement
+ * ---------------------------
+ * Transfer limits count sessions, not the disk and CPU time they use.  When
+ * OSG_CGROUP_ROOT names a cgroup v2 directory, each session is moved at
+ * start-up into a child cgroup chosen by OSG_CGROUP_BY:
+ *
+ *  - user (default): `user-<username>`
+ *  - vo: `vo-<VO name>`, from the first VOMS attribute; `default` without one
+ *  - class: `class-<class>`, where OSG_CGROUP_CLASSES maps users and VOs to
+ *    classes (`high=cms,ligo;low=alice`); `class-default` if unlisted
+ *
+ * Child cgroups are created the first time they are needed and reused
+ * afterwards.  Each time a session joins, the io and cpu controllers are
+ * enabled for the children if a setting needs them, and the cgroup's
+ * io.weight, io.max, and cpu.weight are written: OSG_CGROUP_<NAME>_IO_WEIGHT
+ * (NAME being the upper-cased user, VO, or class) and friends, falling back
+ * to OSG_CGROUP_IO_WEIGHT, etc.  io.max may list several `;`-separated
+ * device lines.
+ *
+ * Globus has switched to the mapped user by the time the DSI starts a
+ * session, so a server started as root forks a helper at activation that
+ * stays root and does the placement.  Sessions ask it over an inherited
+ * socket; the kernel supplies the sender's pid and uid, and the helper only
+ * accepts a username that matches the uid (the VO is taken on trust from
+ * the session, which verified it from the credential).  A server not started as root
+ * places its sessions itself, which works when OSG_CGROUP_ROOT is delegated
+ * to the account it runs as.
+ *
+ * Nothing here may stop a session from starting: failures are logged and
+ * the session stays where it was.
+ *************************************************************************/
+
+#define OSG_CGROUP_DEFAULT_GROUP "default"
+// How long a session waits for the helper to place it.
+#define OSG_CGROUP_HELPER_TIMEOUT_MS 5000
+
+
+// Copy `name` into `result`, replacing characters not safe in a cgroup
+// name (or, for `env`, an environment variable name) with '_'.
+static void
+cgroup_sanitize(const char *name, char *result, size_t result_len, int env)
+{
+    size_t idx;
+    for (idx = 0; name[idx] && (idx < result_len - 1); idx++) {
+        unsigned char c = name[idx];
+        if (env) {
+            result[idx] = isalnum(c) ? toupper(c) : '_';
+        } else {
+            result[idx] = (isalnum(c) || (c == '-') || (c == '.') || (c == '_')) ? c : '_';
+        }
+    }
+    result[idx] = '\0';
+}
+
+
+// Is `name` in the `,`-separated `members`, which ends at `end`?
+static globus_bool_t
+cgroup_member(const char *members, const char *end, const char *name)
+{
+    size_t name_len = strlen(name);
+    while (members < end) {
+        const char *comma = memchr(members, ',', end - members);
+        const char *member_end = comma ? comma : end;
+        if (((size_t)(member_end - members) == name_len) && !strncmp(members, name, name_len)) {
+            return GLOBUS_TRUE;
+        }
+        members = member_end + 1;
+    }
+    return GLOBUS_FALSE;
+}
+
+
+// The class of `username` / `vo` according to OSG_CGROUP_CLASSES.
+static void
+cgroup_class(const char *username, const char *vo, char *result, size_t result_len)
+{
+    strncpy(result, OSG_CGROUP_DEFAULT_GROUP, result_len - 1);
+    result[result_len - 1] = '\0';
+    const char *classes = getenv("OSG_CGROUP_CLASSES");
+    while (classes && *classes) {
+        const char *entry_end = strchr(classes, ';');
+        if (!entry_end) {entry_end = classes + strlen(classes);}
+        const char *equals = memchr(classes, '=', entry_end - classes);
+        if (equals && (equals > classes) &&
+            (cgroup_member(equals + 1, entry_end, username) || (*vo && cgroup_member(equals + 1, entry_end, vo))))
+        {
+            size_t len = equals - classes;
+            if (len >= result_len) {len = result_len - 1;}
+            memcpy(result, classes, len);
+            result[len] = '\0';
+            return;
+        }
+        classes = *entry_end ? entry_end + 1 : entry_end;
+    }
+}
+
+
+static int
+cgroup_write(const char *dir, const char *file, const char *value)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    path[sizeof(path)-1] = '\0';
+    int fd = open(path, O_WRONLY);
+    if (fd == -1) {return errno;}
+    ssize_t retval = write(fd, value, strlen(value));
+    int saved_errno = errno;
+    close(fd);
+    return retval == -1 ? saved_errno : 0;
+}
+
+
+// OSG_CGROUP_<name>_<setting>, or OSG_CGROUP_<setting> if not set.
+static const char *
+cgroup_setting(const char *env_name, const char *setting)
+{
+    char env_var[300];
+    snprintf(env_var, sizeof(env_var), "OSG_CGROUP_%s_%s", env_name, setting);
+    env_var[sizeof(env_var)-1] = '\0';
+    const char *value = getenv(env_var);
+    if (value) {return value;}
+    snprintf(env_var, sizeof(env_var), "OSG_CGROUP_%s", setting);
+    return getenv(env_var);
+}
+
+
+static void
+cgroup_apply(const char *group_dir, const char *file, const char *value, char *message, size_t message_len)
+{
+    int error = cgroup_write(group_dir, file, value);
+    if (error && !*message) {
+        snprintf(message, message_len, "Unable to set %s/%s to %s: %s", group_dir, file, value, strerror(error));
+    }
+}
+
+
+// Enable the controllers `group_dir` needs and write its settings.
+// Failures are noted in `message` (if still empty) and do not stop the move.
+static void
+cgroup_configure(const char *root, const char *group_dir, const char *env_name, char *message, size_t message_len)
+{
+    const char *io_weight = cgroup_setting(env_name, "IO_WEIGHT");
+    const char *io_max = cgroup_setting(env_name, "IO_MAX");
+    const char *cpu_weight = cgroup_setting(env_name, "CPU_WEIGHT");
+
+    // A controller's files only appear once the parent hands it to its
+    // children; failures show up below when the settings are written.
+    char control_file[PATH_MAX + 32];
+    snprintf(control_file, sizeof(control_file), "%s/io.weight", group_dir);
+    if ((io_weight || io_max) && (access(control_file, F_OK) == -1)) {
+        cgroup_write(root, "cgroup.subtree_control", "+io");
+    }
+    snprintf(control_file, sizeof(control_file), "%s/cpu.weight", group_dir);
+    if (cpu_weight && (access(control_file, F_OK) == -1)) {
+        cgroup_write(root, "cgroup.subtree_control", "+cpu");
+    }
+
+    if (io_weight) {cgroup_apply(group_dir, "io.weight", io_weight, message, message_len);}
+    if (cpu_weight) {cgroup_apply(group_dir, "cpu.weight", cpu_weight, message, message_len);}
+    // io.max takes one device per write.
+    while (io_max && *io_max) {
+        const char *end = strchr(io_max, ';');
+        size_t len = end ? (size_t)(end - io_max) : strlen(io_max);
+        char line[256];
+        if (len >= sizeof(line)) {len = sizeof(line) - 1;}
+        memcpy(line, io_max, len);
+        line[len] = '\0';
+        if (*line) {cgroup_apply(group_dir, "io.max", line, message, message_len);}
+        io_max = end ? end + 1 : NULL;
+    }
+}
+
+
+/*
+ * Place process `pid` of `username` / `vo` in its cgroup and (re)apply the
+ * cgroup's settings.  Returns 0 or the errno that kept the process where it
+ * was; `message` describes any failure, fatal or not.  `group_dir` gets the
+ * chosen cgroup, or "" if the session is not to be placed.
+ */
+static int
+cgroup_place(const char *username, const char *vo, pid_t pid, char *group_dir, size_t group_dir_len,
+             char *message, size_t message_len)
+{
+    *group_dir = '\0';
+    *message = '\0';
+    const char *root = getenv("OSG_CGROUP_ROOT");
+    if (!root || !*root) {return 0;}
+
+    const char *by = getenv("OSG_CGROUP_BY");
+    const char *prefix;
+    char name[256];
+    if (!by || !strcmp(by, "user")) {
+        prefix = "user";
+        strncpy(name, username, 255);
+        name[255] = '\0';
+    } else if (!strcmp(by, "vo")) {
+        prefix = "vo";
+        strncpy(name, *vo ? vo : OSG_CGROUP_DEFAULT_GROUP, 255);
+        name[255] = '\0';
+    } else if (!strcmp(by, "class")) {
+        prefix = "class";
+        cgroup_class(username, vo, name, sizeof(name));
+    } else {
+        snprintf(message, message_len, "Unknown OSG_CGROUP_BY value %s; not placing session in a cgroup", by);
+        return EINVAL;
+    }
+    if (!*name) {return 0;}
+
+    char group_name[256], env_name[256];
+    cgroup_sanitize(name, group_name, sizeof(group_name), 0);
+    cgroup_sanitize(name, env_name, sizeof(env_name), 1);
+    snprintf(group_dir, group_dir_len, "%s/%s-%s", root, prefix, group_name);
+    group_dir[group_dir_len-1] = '\0';
+
+    if ((mkdir(group_dir, 0755) == -1) && (errno != EEXIST)) {
+        int error = errno;
+        snprintf(message, message_len, "Unable to create cgroup %s: %s", group_dir, strerror(error));
+        return error;
+    }
+    cgroup_configure(root, group_dir, env_name, message, message_len);
+
+    char pid_str[32];
+    snprintf(pid_str, sizeof(pid_str), "%d", (int)pid);
+    int error = cgroup_write(group_dir, "cgroup.procs", pid_str);
+    if (error) {
+        snprintf(message, message_len, "Unable to move session into cgroup %s: %s", group_dir, strerror(error));
+    }
+    return error;
+}
+
+
+/*
+ * The placement helper.  A request is "<username>\0<vo>\0", sent with
+ * SCM_RIGHTS carrying the socket for the reply; the kernel attaches the
+ * sender's credentials (SO_PASSCRED).
+ */
+typedef struct {
+    int error;
+    char group_dir[PATH_MAX];
+    char message[512];
+} osg_cgroup_reply_t;
+
+static int cgroup_helper_fd = -1;
+
+static void
+cgroup_helper_serve(int fd)
+{
+    while (1) {
+        char request[512];
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int))];
+        } control;
+        struct iovec iov = {request, sizeof(request) - 1};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        ssize_t len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (len == -1 && errno == EINTR) {continue;}
+        // Zero once the server and every session have closed their end.
+        if (len <= 0) {return;}
+        request[len] = '\0';
+
+        struct ucred *cred = NULL;
+        int reply_fd = -1;
+        struct cmsghdr *cmsg;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET) {continue;}
+            if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+                cred = (struct ucred *)CMSG_DATA(cmsg);
+            } else if (cmsg->cmsg_type == SCM_RIGHTS) {
+                memcpy(&reply_fd, CMSG_DATA(cmsg), sizeof(int));
+            }
+        }
+        if (reply_fd == -1) {continue;}
+
+        osg_cgroup_reply_t reply;
+        memset(&reply, 0, sizeof(reply));
+        const char *username = request;
+        const char *vo = request + strlen(request) + 1;
+        if (vo > request + len) {vo = "";}
+        struct passwd *pw = cred ? getpwnam(username) : NULL;
+        if (!cred) {
+            reply.error = EPERM;
+            snprintf(reply.message, sizeof(reply.message), "cgroup request for %.255s carried no credentials", username);
+        } else if (cred->uid && (!pw || (pw->pw_uid != cred->uid))) {
+            reply.error = EPERM;
+            snprintf(reply.message, sizeof(reply.message), "cgroup request for %.255s came from uid %d", username, (int)cred->uid);
+        } else {
+            reply.error = cgroup_place(username, vo, cred->pid, reply.group_dir, sizeof(reply.group_dir),
+                                       reply.message, sizeof(reply.message));
+        }
+        send(reply_fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+        close(reply_fd);
+    }
+}
+
+
+void
+osg_cgroup_init(void)
+{
+    const char *root = getenv("OSG_CGROUP_ROOT");
+    if (!root || !*root || geteuid()) {return;}
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1) {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Unable to create cgroup helper socket: %s\n", strerror(errno));
+        return;
+    }
+    int on = 1;
+    setsockopt(fds[1], SOL_SOCKET, SO_PASSCRED, &on, sizeof(on));
+    pid_t pid = fork();
+    if (pid == -1) {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Unable to start cgroup helper: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        cgroup_helper_serve(fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    cgroup_helper_fd = fds[0];
+    globus_gfs_log_message(GLOBUS_GFS_LOG_INFO, "Started cgroup helper (pid %d) for %s.\n", (int)pid, root);
+}
+
+
+// Ask the helper to place this process; returns 0 or an errno.
+static int
+cgroup_helper_request(const char *username, const char *vo, osg_cgroup_reply_t *reply)
+{
+    char request[512];
+    size_t username_len = strlen(username), vo_len = strlen(vo);
+    if (username_len + vo_len + 2 > sizeof(request)) {return ENAMETOOLONG;}
+    memcpy(request, username, username_len + 1);
+    memcpy(request + username_len + 1, vo, vo_len + 1);
+
+    int reply_fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, reply_fds) == -1) {return errno;}
+
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {request, username_len + vo_len + 2};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &reply_fds[1], sizeof(int));
+
+    int error = 0;
+    if (sendmsg(cgroup_helper_fd, &msg, MSG_NOSIGNAL) == -1) {error = errno;}
+    close(reply_fds[1]);
+    if (!error) {
+        struct pollfd pfd = {reply_fds[0], POLLIN, 0};
+        int retval = poll(&pfd, 1, OSG_CGROUP_HELPER_TIMEOUT_MS);
+        if (retval == 0) {
+            error = ETIMEDOUT;
+        } else if (retval == -1) {
+            error = errno;
+        } else if (recv(reply_fds[0], reply, sizeof(*reply), 0) != sizeof(*reply)) {
+            error = EPIPE;
+        }
+    }
+    close(reply_fds[0]);
+    return error;
+}
+
+
+void
+osg_cgroup_join(const char *username, const char *vo)
+{
+    const char *root = getenv("OSG_CGROUP_ROOT");
+    if (!root || !*root) {return;}
+
+    osg_cgroup_reply_t reply;
+    memset(&reply, 0, sizeof(reply));
+    if (cgroup_helper_fd != -1) {
+        int error = cgroup_helper_request(username, vo, &reply);
+        if (error) {
+            globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Unable to reach the cgroup helper: %s\n", strerror(error));
+            return;
+        }
+    } else {
+        reply.error = cgroup_place(username, vo, getpid(), reply.group_dir, sizeof(reply.group_dir),
+                                   reply.message, sizeof(reply.message));
+    }
+    if (*reply.message) {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "%s%s\n", reply.message,
+            (reply.error && (cgroup_helper_fd == -1) && geteuid()) ? " (server was not started as root)" : "");
+    }
+    if (!reply.error && *reply.group_dir) {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_DUMP, "Session for %s placed in cgroup %s.\n", username, reply.group_dir);
+    }
+}
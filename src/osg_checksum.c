@@ -0,0 +1,358 @@
+
+#include "osg_extensions.h"
+
+#include <openssl/evp.h>
+
+#include <string.h>
+#include <strings.h>
+
+/*************************************************************************
+ * Inline checksums
+ * ----------------
+ * Uploads handled by osg_recv() feed every block through the algorithms
+ * listed in OSG_INLINE_CHECKSUM.  Digests must see the file in order, so we
+ * hash the contiguous prefix as it grows; blocks that land beyond the
+ * prefix (parallel streams) are remembered as ranges and read back from
+ * the file - usually still in the page cache - once the gap is filled.
+ *
+ * The most recent results are kept for the lifetime of the session process,
+ * which is where the client's CKSM after the upload is served from.
+ *************************************************************************/
+
+#define OSG_CHECKSUM_MAX_ALGS 8
+#define OSG_CHECKSUM_CATCHUP_SIZE (1024*1024)
+// Results remembered per session; older ones fall back to reading the file.
+#define OSG_CHECKSUM_MAX_RESULTS 64
+
+typedef enum {
+    OSG_CKSM_MD5,
+    OSG_CKSM_SHA1,
+    OSG_CKSM_SHA256,
+    OSG_CKSM_SHA512,
+    OSG_CKSM_ADLER32
+} osg_checksum_type_t;
+
+typedef struct {
+    const char *name;
+    osg_checksum_type_t type;
+} osg_checksum_alg_t;
+
+static const osg_checksum_alg_t osg_checksum_algs[] =
+{
+    {"MD5", OSG_CKSM_MD5},
+    {"SHA1", OSG_CKSM_SHA1},
+    {"SHA256", OSG_CKSM_SHA256},
+    {"SHA512", OSG_CKSM_SHA512},
+    {"ADLER32", OSG_CKSM_ADLER32},
+    {NULL, 0}
+};
+
+typedef struct {
+    const osg_checksum_alg_t *alg;
+    EVP_MD_CTX *md_ctx;
+    uint32_t adler;
+} osg_checksum_state_t;
+
+struct osg_checksum_s {
+    int count;
+    osg_checksum_state_t state[OSG_CHECKSUM_MAX_ALGS];
+    globus_off_t frontier;
+    globus_range_list_t pending;
+    globus_bool_t valid;
+    // Read-back buffer for checksum_catch_up(), allocated on first use.
+    globus_byte_t *catchup_buffer;
+};
+
+typedef struct osg_checksum_result_s {
+    char *pathname;
+    char *alg;
+    char *value;
+    globus_off_t size;
+    struct timespec mtime;
+    ino_t ino;
+    dev_t dev;
+    struct osg_checksum_result_s *next;
+} osg_checksum_result_t;
+
+static osg_checksum_result_t *osg_checksum_results = NULL;
+
+
+static uint32_t
+adler32_update(uint32_t adler, const globus_byte_t *buffer, globus_size_t nbytes)
+{
+    uint32_t a = adler & 0xffff;
+    uint32_t b = adler >> 16;
+    while (nbytes > 0) {
+        // 5552 is the largest run that cannot overflow the 32-bit sums.
+        globus_size_t run = nbytes < 5552 ? nbytes : 5552;
+        nbytes -= run;
+        while (run--) {
+            a += *buffer++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+
+static const EVP_MD *
+checksum_md(osg_checksum_type_t type)
+{
+    switch (type) {
+    case OSG_CKSM_MD5: return EVP_md5();
+    case OSG_CKSM_SHA1: return EVP_sha1();
+    case OSG_CKSM_SHA256: return EVP_sha256();
+    case OSG_CKSM_SHA512: return EVP_sha512();
+    default: return NULL;
+    }
+}
+
+
+osg_checksum_t *
+osg_checksum_create(void)
+{
+    const char *algs_env = getenv("OSG_INLINE_CHECKSUM");
+    if (!algs_env || !*algs_env) {return NULL;}
+
+    osg_checksum_t *cksm = (osg_checksum_t *)globus_calloc(1, sizeof(osg_checksum_t));
+    if (!cksm) {return NULL;}
+
+    char algs[256];
+    strncpy(algs, algs_env, 255);
+    algs[255] = '\0';
+    char *saveptr = NULL;
+    char *name;
+    for (name = strtok_r(algs, ", ", &saveptr); name; name = strtok_r(NULL, ", ", &saveptr)) {
+        const osg_checksum_alg_t *alg;
+        for (alg = osg_checksum_algs; alg->name; alg++) {
+            if (!strcasecmp(alg->name, name)) {break;}
+        }
+        if (!alg->name) {
+            globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Ignoring unknown inline checksum algorithm %s.\n", name);
+            continue;
+        }
+        if (cksm->count == OSG_CHECKSUM_MAX_ALGS) {break;}
+        osg_checksum_state_t *state = &cksm->state[cksm->count];
+        state->alg = alg;
+        const EVP_MD *md = checksum_md(alg->type);
+        if (md) {
+            state->md_ctx = EVP_MD_CTX_create();
+            if (!state->md_ctx || !EVP_DigestInit_ex(state->md_ctx, md, NULL)) {
+                if (state->md_ctx) {EVP_MD_CTX_destroy(state->md_ctx);}
+                state->md_ctx = NULL;
+                continue;
+            }
+        } else {
+            state->adler = 1;
+        }
+        cksm->count++;
+    }
+    if (!cksm->count) {
+        globus_free(cksm);
+        return NULL;
+    }
+    globus_range_list_init(&cksm->pending);
+    cksm->valid = GLOBUS_TRUE;
+    return cksm;
+}
+
+
+static void
+checksum_hash(osg_checksum_t *cksm, const globus_byte_t *buffer, globus_size_t nbytes)
+{
+    int idx;
+    for (idx = 0; idx < cksm->count; idx++) {
+        osg_checksum_state_t *state = &cksm->state[idx];
+        if (state->md_ctx) {
+            EVP_DigestUpdate(state->md_ctx, buffer, nbytes);
+        } else {
+            state->adler = adler32_update(state->adler, buffer, nbytes);
+        }
+    }
+    cksm->frontier += nbytes;
+}
+
+
+/*
+ * Hash any already-written ranges which now touch the frontier, reading
+ * them back from the file.
+ */
+static void
+checksum_catch_up(osg_checksum_t *cksm, int fd)
+{
+    while (cksm->valid && globus_range_list_size(cksm->pending)) {
+        globus_off_t offset, length;
+        globus_range_list_at(cksm->pending, 0, &offset, &length);
+        if (offset > cksm->frontier) {break;}
+        globus_off_t end = offset + length;
+        globus_range_list_remove(cksm->pending, offset, length);
+        if (!cksm->catchup_buffer &&
+            !(cksm->catchup_buffer = (globus_byte_t *)globus_malloc(OSG_CHECKSUM_CATCHUP_SIZE)))
+        {
+            cksm->valid = GLOBUS_FALSE;
+            break;
+        }
+        globus_byte_t *buffer = cksm->catchup_buffer;
+        while (cksm->frontier < end) {
+            globus_off_t want = end - cksm->frontier;
+            want = want < OSG_CHECKSUM_CATCHUP_SIZE ? want : OSG_CHECKSUM_CATCHUP_SIZE;
+            ssize_t nread = pread(fd, buffer, want, cksm->frontier);
+            if (nread <= 0) {
+                if ((nread == -1) && (errno == EINTR)) {continue;}
+                cksm->valid = GLOBUS_FALSE;
+                break;
+            }
+            checksum_hash(cksm, buffer, nread);
+        }
+    }
+}
+
+
+void
+osg_checksum_update(osg_checksum_t *cksm, int fd, const globus_byte_t *buffer, globus_off_t offset, globus_size_t nbytes)
+{
+    if (!cksm->valid || !nbytes) {return;}
+
+    if (offset == cksm->frontier) {
+        checksum_hash(cksm, buffer, nbytes);
+        checksum_catch_up(cksm, fd);
+    } else if (offset > cksm->frontier) {
+        globus_range_list_insert(cksm->pending, offset, nbytes);
+    } else {
+        // Rewriting bytes we already hashed; the digest no longer matches the file.
+        cksm->valid = GLOBUS_FALSE;
+    }
+}
+
+
+static void
+checksum_result_free(osg_checksum_result_t *entry)
+{
+    globus_free(entry->pathname);
+    globus_free(entry->alg);
+    globus_free(entry->value);
+    globus_free(entry);
+}
+
+
+static void
+checksum_remember(const char *pathname, const char *alg, const char *value, const struct stat *st)
+{
+    osg_checksum_result_t **prev = &osg_checksum_results;
+    osg_checksum_result_t *entry;
+    for (entry = osg_checksum_results; entry; prev = &entry->next, entry = entry->next) {
+        if (!strcmp(entry->pathname, pathname) && !strcasecmp(entry->alg, alg)) {
+            *prev = entry->next;
+            checksum_result_free(entry);
+            break;
+        }
+    }
+
+    entry = (osg_checksum_result_t *)globus_calloc(1, sizeof(osg_checksum_result_t));
+    if (!entry) {return;}
+    entry->pathname = globus_libc_strdup(pathname);
+    entry->alg = globus_libc_strdup(alg);
+    entry->value = globus_libc_strdup(value);
+    if (!entry->pathname || !entry->alg || !entry->value) {
+        if (entry->pathname) {globus_free(entry->pathname);}
+        if (entry->alg) {globus_free(entry->alg);}
+        if (entry->value) {globus_free(entry->value);}
+        globus_free(entry);
+        return;
+    }
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim;
+    entry->ino = st->st_ino;
+    entry->dev = st->st_dev;
+    entry->next = osg_checksum_results;
+    osg_checksum_results = entry;
+
+    // Newest first; drop whatever is beyond the cap.
+    int count = 0;
+    for (prev = &osg_checksum_results; *prev; prev = &(*prev)->next) {
+        if (++count == OSG_CHECKSUM_MAX_RESULTS) {
+            while ((*prev)->next) {
+                entry = (*prev)->next;
+                (*prev)->next = entry->next;
+                checksum_result_free(entry);
+            }
+            break;
+        }
+    }
+}
+
+
+void
+osg_checksum_finish(osg_checksum_t *cksm, int fd, const char *pathname)
+{
+    struct stat st;
+    if (!cksm->valid || fstat(fd, &st) || (st.st_size != cksm->frontier) ||
+        globus_range_list_size(cksm->pending))
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_DUMP, "Inline checksum of %s incomplete; CKSM will read the file.\n", pathname);
+        return;
+    }
+
+    int idx;
+    for (idx = 0; idx < cksm->count; idx++) {
+        osg_checksum_state_t *state = &cksm->state[idx];
+        char value[2*EVP_MAX_MD_SIZE+1];
+        if (state->md_ctx) {
+            unsigned char digest[EVP_MAX_MD_SIZE];
+            unsigned int digest_len = 0;
+            if (!EVP_DigestFinal_ex(state->md_ctx, digest, &digest_len)) {continue;}
+            EVP_MD_CTX_destroy(state->md_ctx);
+            state->md_ctx = NULL;
+            unsigned int idx2;
+            for (idx2 = 0; idx2 < digest_len; idx2++) {
+                sprintf(value + 2*idx2, "%02x", digest[idx2]);
+            }
+            value[2*digest_len] = '\0';
+        } else {
+            snprintf(value, sizeof(value), "%08x", state->adler);
+        }
+        checksum_remember(pathname, state->alg->name, value, &st);
+        globus_gfs_log_message(GLOBUS_GFS_LOG_DUMP, "Inline %s checksum of %s is %s.\n", state->alg->name, pathname, value);
+    }
+}
+
+
+void
+osg_checksum_destroy(osg_checksum_t *cksm)
+{
+    int idx;
+    for (idx = 0; idx < cksm->count; idx++) {
+        if (cksm->state[idx].md_ctx) {EVP_MD_CTX_destroy(cksm->state[idx].md_ctx);}
+    }
+    globus_range_list_destroy(cksm->pending);
+    if (cksm->catchup_buffer) {globus_free(cksm->catchup_buffer);}
+    globus_free(cksm);
+}
+
+
+globus_bool_t
+osg_checksum_lookup(const char *pathname, const char *alg, globus_off_t offset, globus_off_t length, char **result)
+{
+    if (!pathname || !alg || offset) {return GLOBUS_FALSE;}
+
+    osg_checksum_result_t *entry;
+    for (entry = osg_checksum_results; entry; entry = entry->next) {
+        if (!strcmp(entry->pathname, pathname) && !strcasecmp(entry->alg, alg)) {break;}
+    }
+    if (!entry) {return GLOBUS_FALSE;}
+
+    // Only trust the result if the file is unchanged since we wrote it.
+    struct stat st;
+    if (stat(pathname, &st) || (st.st_size != entry->size) || (st.st_ino != entry->ino) ||
+        (st.st_dev != entry->dev) || (st.st_mtim.tv_sec != entry->mtime.tv_sec) ||
+        (st.st_mtim.tv_nsec != entry->mtime.tv_nsec))
+    {
+        return GLOBUS_FALSE;
+    }
+    if ((length >= 0) && (length != entry->size)) {return GLOBUS_FALSE;}
+
+    *result = globus_libc_strdup(entry->value);
+    return *result != NULL;
+}
@@ -0,0 +1,127 @@
+
+#include "osg_extensions.h"
+
+#include <string.h>
+#include <strings.h>
+
+/*************************************************************************
+ * Configuration helpers
+ * ---------------------
+ * Like the rest of the module, configuration comes from environment
+ * variables set in /etc/gridftp.d or /etc/sysconfig/globus-gridftp-server.
+ *************************************************************************/
+
+/*
+ * Parse a byte count with an optional K, M, G, or T suffix (powers of 1024).
+ * Returns -1 if the value is not a valid size.
+ */
+globus_off_t
+osg_parse_size(const char *value)
+{
+    if (!value) {return -1;}
+    char *end = NULL;
+    errno = 0;
+    long long size = strtoll(value, &end, 10);
+    if (errno || (end == value) || (size < 0)) {return -1;}
+    switch (toupper(*end)) {
+    case 'T': size *= 1024;  /* fall through */
+    case 'G': size *= 1024;  /* fall through */
+    case 'M': size *= 1024;  /* fall through */
+    case 'K': size *= 1024;
+        end++;
+    default:
+        break;
+    }
+    if (*end && (toupper(*end) != 'B')) {return -1;}
+    return size;
+}
+
+
+/*
+ * Does `pathname` live under directory `prefix`?  "/data" matches "/data"
+ * and "/data/foo" but not "/database".
+ */
+globus_bool_t
+osg_path_has_prefix(const char *pathname, const char *prefix)
+{
+    size_t prefix_len = strlen(prefix);
+    if (!prefix_len) {return GLOBUS_FALSE;}
+    while (prefix_len > 1 && prefix[prefix_len-1] == '/') {prefix_len--;}
+    if (strncmp(pathname, prefix, prefix_len)) {return GLOBUS_FALSE;}
+    return (pathname[prefix_len] == '\0') || (pathname[prefix_len] == '/') ||
+           (prefix[prefix_len-1] == '/');
+}
+
+
+/*************************************************************************
+ * osg_write_policy_lookup
+ * -----------------------
+ * OSG_WRITE_POLICY holds a semicolon-separated list of rules of the form
+ *   /path/prefix:option,option,...
+ * where the options are `prealloc`, `gather=SIZE`, and `writebehind=SIZE`.
+ * The rule with the longest prefix matching the upload's path applies.
+ *************************************************************************/
+void
+osg_write_policy_lookup(const char *pathname, osg_write_policy_t *policy)
+{
+    memset(policy, '\0', sizeof(*policy));
+
+    const char *policy_env = getenv("OSG_WRITE_POLICY");
+    if (!policy_env || !pathname) {return;}
+
+    char *rules = globus_libc_strdup(policy_env);
+    if (!rules) {return;}
+
+    size_t best_len = 0;
+    char *rule_save = NULL;
+    char *rule;
+    for (rule = strtok_r(rules, ";", &rule_save); rule; rule = strtok_r(NULL, ";", &rule_save)) {
+        while (isspace(*rule)) {rule++;}
+        char *options = strchr(rule, ':');
+        if (!options) {continue;}
+        *options++ = '\0';
+        size_t prefix_len = strlen(rule);
+        if (!prefix_len || (prefix_len <= best_len) || !osg_path_has_prefix(pathname, rule)) {continue;}
+
+        osg_write_policy_t candidate;
+        memset(&candidate, '\0', sizeof(candidate));
+        char *option_save = NULL;
+        char *option;
+        for (option = strtok_r(options, ", ", &option_save); option; option = strtok_r(NULL, ", ", &option_save)) {
+            char *value = strchr(option, '=');
+            if (value) {*value++ = '\0';}
+            if (!strcasecmp(option, "prealloc")) {
+                candidate.prealloc = GLOBUS_TRUE;
+            } else if (!strcasecmp(option, "gather") && (osg_parse_size(value) > 0)) {
+                candidate.gather_size = osg_parse_size(value);
+            } else if (!strcasecmp(option, "writebehind") && (osg_parse_size(value) > 0)) {
+                candidate.writebehind_size = osg_parse_size(value);
+            } else {
+                globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Ignoring invalid write policy option %s for %s.\n", option, rule);
+            }
+        }
+        *policy = candidate;
+        best_len = prefix_len;
+    }
+    globus_free(rules);
+}
+
+
+/*
+ * OSG_SMALL_FILE_THRESHOLD: files up to this size take the small-file
+ * paths in osg_send.c and osg_recv.c.  Returns 0 if disabled.
+ */
+globus_off_t
+osg_small_file_threshold(void)
+{
+    static globus_off_t threshold = -1;
+    if (threshold == -1) {
+        const char *threshold_char = getenv("OSG_SMALL_FILE_THRESHOLD");
+        threshold = threshold_char ? osg_parse_size(threshold_char) : 0;
+        if (threshold < 0) {
+            globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Invalid OSG_SMALL_FILE_THRESHOLD %s; small-file path disabled.\n", threshold_char);
+            threshold = 0;
+        }
+    }
+    return threshold;
+}
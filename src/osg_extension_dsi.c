@@ -2,36 +2,18 @@
 #include "globus_gridftp_server.h"
 #include "version.h"
 #include "globus_error_macros.h"
+#include "osg_extensions.h"
 
 #ifdef VOMS_FOUND
 #include "voms_apic.h"
 #endif  // VOMS_FOUND
 
 #include <string.h>
+#include <sys/wait.h>
 
 static int osg_activate(void);
 static int osg_deactivate(void);
 
-// From globus_i_gridftp_server.h
-#define GlobusGFSErrorGenericStr(_res, _fmt)                           \
-do                                                                     \
-{                                                                      \
-        char *                          _tmp_str;                      \
-        _tmp_str = globus_common_create_string _fmt;                   \
-        _res = globus_error_put(                                       \
-            globus_error_construct_error(                              \
-                GLOBUS_NULL,                                           \
-                GLOBUS_NULL,                                           \
-                GLOBUS_GFS_ERROR_GENERIC,                              \
-                __FILE__,                                              \
-                _gfs_name,                                             \
-                __LINE__,                                              \
-                "%s",                                                  \
-                _tmp_str));                                            \
-        globus_free(_tmp_str);                                         \
-                                                                       \
-} while(0)
-
 static globus_result_t
 check_connection_limits(const char *username, int user_transfer_limit, int transfer_limit);
 
@@ -42,7 +24,13 @@ static int
 dumb_sem_open(const char *fname, int flags, mode_t mode, int value);
 
 static int
-dumb_sem_timedwait(int fd, int value, int secs);
+dumb_sem_trywait(int fd, int value, int *slot);
+
+static int
+dumb_sem_timedwait(int fd, int value, int secs, int *slot);
+
+static int
+admission_wait(int fd, int value, const char *sem_name, int *retry_after, int *slot);
 
 static globus_version_t osg_local_version =
 {
@@ -71,6 +59,14 @@ static globus_extension_handle_t osg_dsi_handle = NULL;
 
 static globus_gfs_storage_command_t original_command_function = NULL;
 static globus_gfs_storage_init_t original_init_function = NULL;
+static globus_gfs_storage_destroy_t original_destroy_function = NULL;
+globus_gfs_storage_transfer_t original_recv_function = NULL;
+globus_gfs_storage_transfer_t original_send_function = NULL;
+globus_gfs_storage_stat_t original_stat_function = NULL;
+
+globus_bool_t osg_dsi_is_file = GLOBUS_FALSE;
+
+char osg_session_username[256] = {};
 
 enum {
 	GLOBUS_GFS_OSG_CMD_SITE_USAGE = GLOBUS_GFS_MIN_CUSTOM_CMD,
@@ -82,6 +78,9 @@ osg_extensions_init(globus_gfs_operation_t op, globus_gfs_session_info_t * sessi
 {
     GlobusGFSName(osg_extensions_init);
 
+    osg_startup_timer_t timer;
+    osg_startup_timer_start(&timer);
+
     globus_result_t result = globus_gridftp_server_add_command(op, "SITE USAGE",
                                  GLOBUS_GFS_OSG_CMD_SITE_USAGE,
                                  3,
@@ -93,6 +92,8 @@ osg_extensions_init(globus_gfs_operation_t op, globus_gfs_session_info_t * sessi
     if (result != GLOBUS_SUCCESS)
     {
         result = GlobusGFSErrorWrapFailed("Failed to add custom 'SITE USAGE' command", result);
+        osg_startup_timer_mark(&timer, OSG_STARTUP_PHASE_ADD_COMMAND);
+        osg_startup_timer_report(&timer, session->username);
         globus_gridftp_server_finished_session_start(op,
                                                  result,
                                                  NULL,
@@ -100,6 +101,10 @@ osg_extensions_init(globus_gfs_operation_t op, globus_gfs_session_info_t * sessi
                                                  NULL);
         return;
     }
+    osg_startup_timer_mark(&timer, OSG_STARTUP_PHASE_ADD_COMMAND);
+
+    // VO of the first VOMS attribute, if any; used for cgroup placement.
+    char session_vo[256] = {};
 
 #ifdef VOMS_FOUND
 
@@ -121,6 +126,10 @@ osg_extensions_init(globus_gfs_operation_t op, globus_gfs_session_info_t * sessi
                 char *pos = msg;
                 int char_remaining = 1022;
                 vext = vdata->data[idx];
+                if (!idx && vext->voname)
+                {
+                    strncpy(session_vo, vext->voname, 255);
+                }
                 int this_round;
                 if ((char_remaining > 0) && vext->voname)
                 {
@@ -160,6 +169,7 @@ osg_extensions_init(globus_gfs_operation_t op, globus_gfs_session_info_t * sessi
     }
 
 #endif  // VOMS_FOUND
+    osg_startup_timer_mark(&timer, OSG_STARTUP_PHASE_VOMS);
 
     int user_transfer_limit;
     int transfer_limit;
@@ -168,11 +178,15 @@ osg_extensions_init(globus_gfs_operation_t op, globus_gfs_session_info_t * sessi
     size_t strlength = strlen(session->username);
     strlength = strlength < 256 ? strlength : 255;
     strncpy(username, session->username, strlength);
+    strcpy(osg_session_username, username);
 
     get_connection_limits_params(username, &user_transfer_limit, &transfer_limit);
+    osg_startup_timer_mark(&timer, OSG_STARTUP_PHASE_LIMITS_PARAMS);
 
     result = check_connection_limits(username, user_transfer_limit, transfer_limit);
+    osg_startup_timer_mark(&timer, OSG_STARTUP_PHASE_LIMITS_WAIT);
     if (result != GLOBUS_SUCCESS) {
+        osg_startup_timer_report(&timer, username);
         globus_gridftp_server_finished_session_start(op,
                                                      result,
                                                      NULL,
@@ -181,7 +195,22 @@ osg_extensions_init(globus_gfs_operation_t op, globus_gfs_session_info_t * sessi
         return;
     }
 
+    osg_cgroup_join(username, session_vo);
+    osg_startup_timer_mark(&timer, OSG_STARTUP_PHASE_CGROUP);
+
     original_init_function(op, session);
+    osg_startup_timer_mark(&timer, OSG_STARTUP_PHASE_DSI_INIT);
+    osg_startup_timer_report(&timer, username);
+}
+
+static void
+osg_extensions_destroy(void *user_arg)
+{
+    // The session is over: give its transfer slots back now, recording
+    // how long they were held, rather than when the process exits.
+    osg_admission_release();
+    osg_listing_cache_settle();
+    if (original_destroy_function) {original_destroy_function(user_arg);}
 }
 
 static void
@@ -230,8 +259,9 @@ get_connection_limits_params(
  * check_connection_limits
  * -----------------------
  * Make sure the number of concurrent connections to the server is below a certain
- * threshold.  If we are over-threshold, wait for a fixed amount of time (1
- * minute) and fail the transfer.
+ * threshold.  If we are over-threshold, wait for up to OSG_QUEUE_MAX_WAIT
+ * seconds (1 minute by default) and fail the transfer; if the wait is
+ * predicted to be too long, fail at once (see osg_admission.c).
  * Implementation baed on named POSIX semaphores.
  *************************************************************************/
 static globus_result_t
@@ -246,18 +276,27 @@ check_connection_limits(const char *username, int user_transfer_limit, int trans
         strcpy(local_host, "UNKNOWN");
     }
 
+    char user_sem_name[256];
     int user_lock_count = 0;
+    int usem = -1, user_slot = -1;
     if (user_transfer_limit > 0) {
-        char user_sem_name[256];
         snprintf(user_sem_name, 255, "/dev/shm/gridftp-osg-%s-%d", username, user_transfer_limit);
         user_sem_name[255] = '\0';
-        int usem = dumb_sem_open(user_sem_name, O_CREAT, 0600, user_transfer_limit);
+        usem = dumb_sem_open(user_sem_name, O_CREAT, 0600, user_transfer_limit);
         if (usem == -1) {
             SystemError(username, local_host, "Failure when determining user connection limit", result);
             return result;
         }
-        if (-1 == (user_lock_count = dumb_sem_timedwait(usem, user_transfer_limit, 60))) {
-            if (errno == ETIMEDOUT) {
+        int retry_after = 0;
+        if (-1 == (user_lock_count = admission_wait(usem, user_transfer_limit, user_sem_name, &retry_after, &user_slot))) {
+            if (errno == EBUSY) {
+                globus_gfs_log_message(GLOBUS_GFS_LOG_INFO, "Rejecting transfer for %s due to user connection limit of %d; predicted wait %d seconds.\n", username, user_transfer_limit, retry_after);
+                char * failure_msg = (char *)globus_malloc(1024);
+                snprintf(failure_msg, 1024, "Server over the user connection limit of %d; retry after %d seconds", user_transfer_limit, retry_after);
+                failure_msg[1023] = '\0';
+                GenericError(username, local_host, failure_msg, result);
+                globus_free(failure_msg);
+            } else if (errno == ETIMEDOUT) {
                 globus_gfs_log_message(GLOBUS_GFS_LOG_INFO, "Failing transfer for %s due to user connection limit of %d.\n", username, user_transfer_limit);
                 char * failure_msg = (char *)globus_malloc(1024);
                 snprintf(failure_msg, 1024, "Server over the user connection limit of %d", user_transfer_limit);
@@ -273,18 +312,27 @@ check_connection_limits(const char *username, int user_transfer_limit, int trans
         // the server process finishes this connection.
     }
 
+    char global_sem_name[256];
     int global_lock_count = 0;
+    int gsem = -1, global_slot = -1;
     if (transfer_limit > 0) {
-        char global_sem_name[256];
         snprintf(global_sem_name, 255, "/dev/shm//gridftp-osg-overall-%d", transfer_limit);
         global_sem_name[255] = '\0';
-        int gsem = dumb_sem_open(global_sem_name, O_CREAT, 0666, transfer_limit);
+        gsem = dumb_sem_open(global_sem_name, O_CREAT, 0666, transfer_limit);
         if (gsem == -1) {
             SystemError(username, local_host, "Failure when determining global connection limit", result);
             return result;
         }
-        if (-1 == (global_lock_count=dumb_sem_timedwait(gsem, transfer_limit, 60))) {
-            if (errno == ETIMEDOUT) {
+        int retry_after = 0;
+        if (-1 == (global_lock_count=admission_wait(gsem, transfer_limit, global_sem_name, &retry_after, &global_slot))) {
+            if (errno == EBUSY) {
+                globus_gfs_log_message(GLOBUS_GFS_LOG_INFO, "Rejecting transfer for %s due to global connection limit of %d (user has %d transfers); predicted wait %d seconds.\n", username, transfer_limit, user_lock_count, retry_after);
+                char * failure_msg = (char *)globus_malloc(1024);
+                snprintf(failure_msg, 1024, "Server over the global connection limit of %d; retry after %d seconds", transfer_limit, retry_after);
+                failure_msg[1023] = '\0';
+                GenericError(username, local_host, failure_msg, result);
+                globus_free(failure_msg);
+            } else if (errno == ETIMEDOUT) {
                 globus_gfs_log_message(GLOBUS_GFS_LOG_INFO, "Failing transfer for %s due to global connection limit of %d (user has %d transfers).\n", username, transfer_limit, user_lock_count);
                 char * failure_msg = (char *)globus_malloc(1024);
                 snprintf(failure_msg, 1024, "Server over the global connection limit of %d (user has %d transfers)", transfer_limit, user_lock_count);
@@ -299,6 +347,9 @@ check_connection_limits(const char *username, int user_transfer_limit, int trans
         // NOTE: We now purposely leak the semaphore.  It will be automatically closed when
         // the server process finishes this connection.
     }
+    // Only sessions which go on to run count toward the queue statistics.
+    if (user_transfer_limit > 0) {osg_admission_acquired(user_sem_name, 0600, usem, user_slot, user_transfer_limit);}
+    if (transfer_limit > 0) {osg_admission_acquired(global_sem_name, 0666, gsem, global_slot, transfer_limit);}
     if ((transfer_limit > 0) || (user_transfer_limit > 0)) {
         globus_gfs_log_message(GLOBUS_GFS_LOG_INFO, "Proceeding with transfer; user %s has %d active transfers (limit %d); server has %d active transfers (limit %d).\n", username, user_lock_count, user_transfer_limit, global_lock_count, transfer_limit);
     }
@@ -319,38 +370,54 @@ dumb_sem_open(const char *fname, int flags, mode_t mode, int value) {
     return fd;
 }
 
+/*
+ * Try once to take a slot; returns the number of slots taken (including
+ * ours) on success, with the slot taken in `slot`, or -1 with errno EAGAIN
+ * if every slot is busy.
+ */
+static int
+dumb_sem_trywait(int fd, int value, int *slot) {
+    int idx = 0;
+    int lock_count = 0;
+    int need_lock = 1;
+    for (idx=0; idx<value; idx++) {
+        struct flock mylock; memset(&mylock, '\0', sizeof(mylock));
+        mylock.l_type = F_WRLCK;
+        mylock.l_whence = SEEK_SET;
+        mylock.l_start = idx;
+        mylock.l_len = 1;
+        if (0 == fcntl(fd, need_lock ? F_SETLK : F_GETLK, &mylock)) {
+            if (need_lock) {  // We now have the lock.
+                need_lock = 0;
+                *slot = idx;
+                lock_count++;
+            } else if (mylock.l_type != F_UNLCK) {  // We're just seeing how many locks are taken.
+                lock_count++;
+            }
+            continue;
+        }
+        if (errno == EAGAIN || errno == EACCES || errno == EINTR) {
+            lock_count++;
+            continue;
+        }
+        return -1;
+    }
+    if (!need_lock) {  // we were able to take a lock.
+        return lock_count;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
 static int
-dumb_sem_timedwait(int fd, int value, int secs) {
+dumb_sem_timedwait(int fd, int value, int secs, int *slot) {
     struct timespec start, now, sleeptime;
     clock_gettime(CLOCK_MONOTONIC, &start);
     sleeptime.tv_sec = 0;
     sleeptime.tv_nsec = 500*1e6;
     while (1) {
-        int idx = 0;
-        int lock_count = 0;
-        int need_lock = 1;
-        for (idx=0; idx<value; idx++) {
-            struct flock mylock; memset(&mylock, '\0', sizeof(mylock));
-            mylock.l_type = F_WRLCK;
-            mylock.l_whence = SEEK_SET;
-            mylock.l_start = idx;
-            mylock.l_len = 1;
-            if (0 == fcntl(fd, need_lock ? F_SETLK : F_GETLK, &mylock)) {
-                if (need_lock) {  // We now have the lock.
-                    need_lock = 0;
-                    lock_count++;
-                } else if (mylock.l_type != F_UNLCK) {  // We're just seeing how many locks are taken.
-                    lock_count++;
-                }
-                continue;
-            }
-            if (errno == EAGAIN || errno == EACCES || errno == EINTR) {
-                lock_count++;
-                continue;
-            }
-            return -1;
-        }
-        if (!need_lock) {  // we were able to take a lock.
+        int lock_count = dumb_sem_trywait(fd, value, slot);
+        if ((lock_count != -1) || (errno != EAGAIN)) {
             return lock_count;
         }
         nanosleep(&sleeptime, NULL);
@@ -362,6 +429,118 @@ dumb_sem_timedwait(int fd, int value, int secs) {
     }
 }
 
+/*
+ * Take a slot of semaphore `fd`, queueing for up to OSG_QUEUE_MAX_WAIT
+ * seconds if all are busy.  If the predicted wait (see osg_admission.c) is
+ * too long, give up at once: returns -1 with errno EBUSY and the predicted
+ * wait in `retry_after`.  Otherwise behaves as dumb_sem_timedwait().
+ */
+static int
+admission_wait(int fd, int value, const char *sem_name, int *retry_after, int *slot) {
+    int lock_count = dumb_sem_trywait(fd, value, slot);
+    if ((lock_count == -1) && (errno == EAGAIN)) {
+        int waiters_ahead = 0;
+        int waiter = osg_admission_waiter_join(fd, &waiters_ahead);
+        int max_predicted_wait = osg_admission_max_predicted_wait();
+        double predicted = (max_predicted_wait >= 0) ? osg_admission_estimate(sem_name, value, waiters_ahead) : 0;
+        if ((max_predicted_wait >= 0) && (predicted > max_predicted_wait)) {
+            osg_admission_waiter_leave(fd, waiter);
+            *retry_after = (int)predicted + 1;
+            errno = EBUSY;
+            return -1;
+        }
+        lock_count = dumb_sem_timedwait(fd, value, osg_admission_max_wait(), slot);
+        int saved_errno = errno;
+        osg_admission_waiter_leave(fd, waiter);
+        errno = saved_errno;
+    }
+    return lock_count;
+}
+
+/*************************************************************************
+ * osg_site_usage_query
+ * --------------------
+ * Run the site usage script (OSG_SITE_USAGE_SCRIPT) for a token and path.
+ * The script is executed directly, with the token and path as arguments.
+ * On failure, `failure_response` is set to the FTP response to send.
+ *************************************************************************/
+globus_result_t
+osg_site_usage_query(const char *token_name, const char *pathname,
+                     long long *usage_p, long long *free_p, long long *total_p,
+                     const char **failure_response)
+{
+    GlobusGFSName(osg_site_usage_query);
+    globus_result_t result = GLOBUS_SUCCESS;
+
+    const char *script_pathname = getenv("OSG_SITE_USAGE_SCRIPT");
+    if (!script_pathname)
+    {
+        result = GlobusGFSErrorGeneric("Site usage script not configured");
+        *failure_response = "550 Server is not configured to provide site usage.\r\n";
+        return result;
+    }
+    // The pathname comes from the client: pass it as an argument, never
+    // through a shell.
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        result = GlobusGFSErrorSystemError("usage script", errno);
+        *failure_response = "550 Server failed to start usage query.\r\n";
+        return result;
+    }
+    char *script_argv[] = {(char *)script_pathname, (char *)token_name, (char *)pathname, NULL};
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (dup2(pipe_fds[1], STDOUT_FILENO) == -1) {_exit(127);}
+        execv(script_pathname, script_argv);
+        _exit(127);
+    }
+    int saved_errno = errno;
+    close(pipe_fds[1]);
+    if (pid == -1) {
+        close(pipe_fds[0]);
+        result = GlobusGFSErrorSystemError("usage script", saved_errno);
+        *failure_response = "550 Server failed to start usage query.\r\n";
+        return result;
+    }
+    FILE *fp = fdopen(pipe_fds[0], "r");
+    char output[1024];
+    output[0] = '\0';
+    if (fp) {
+        while (fgets(output, 1024, fp) != NULL) {}
+        fclose(fp);
+    } else {
+        close(pipe_fds[0]);
+    }
+
+    int status;
+    pid_t retval;
+    while (((retval = waitpid(pid, &status, 0)) == -1) && (errno == EINTR)) {}
+    if ((retval == -1) || !WIFEXITED(status) || WEXITSTATUS(status))
+    {
+        if (retval == -1) {result = GlobusGFSErrorSystemError("Usage script failed", errno);}
+        else {result = GlobusGFSErrorGeneric("Site usage script failed");}
+        *failure_response = "550 Server usage query failed.\r\n";
+        return result;
+    }
+    char *newline_char = strchr(output, '\n');
+    if (newline_char) {*newline_char = '\0';}
+
+    long long usage, free, total;
+    int output_count = sscanf(output, "%lld %lld %lld", &usage, &free, &total);
+    if (output_count < 2)
+    {
+        result = GlobusGFSErrorGeneric("Invalid output from site usage script");
+        *failure_response = "550 Invalid output from site usage script.\r\n";
+        return result;
+    }
+    if (output_count == 2) {total = usage + free;}
+
+    *usage_p = usage;
+    *free_p = free;
+    *total_p = total;
+    return result;
+}
+
 static void
 site_usage(globus_gfs_operation_t op,
            globus_gfs_command_info_t *cmd_info)
@@ -401,45 +580,14 @@ site_usage(globus_gfs_operation_t op,
         token_name = argv[3];
     }
 
-    const char *script_pathname = getenv("OSG_SITE_USAGE_SCRIPT");
-    if (!script_pathname)
-    {
-        result = GlobusGFSErrorGeneric("Site usage script not configured");
-        globus_gridftp_server_finished_command(op, result, "550 Server is not configured to provide site usage.\r\n");
-        return;
-    }
-    char cmd[256];
-    snprintf(cmd, 256, "%s %s %s", script_pathname, token_name, cmd_info->pathname);
-    cmd[255] = '\0';
-    FILE *fp = popen(cmd, "r");
-    if (fp == NULL) {
-        result = GlobusGFSErrorSystemError("usage script", errno);
-        globus_gridftp_server_finished_command(op, result, "550 Server failed to start usage query.\r\n");
-        return;
-    }
-    char output[1024];
-    while (fgets(output, 1024, fp) != NULL) {}
-
-    int status = pclose(fp);
-    if ((status == -1) || (status > 0))
-    {
-        if (status == -1) {result = GlobusGFSErrorSystemError("Usage script failed", errno);}
-        else {result = GlobusGFSErrorGeneric("Site usage script failed");}
-        globus_gridftp_server_finished_command(op, result, "550 Server usage query failed.\r\n");
-        return;
-    }
-    char *newline_char = strchr(output, '\n');
-    if (newline_char) {*newline_char = '\0';}
-
     long long usage, free, total;
-    int output_count = sscanf(output, "%lld %lld %lld", &usage, &free, &total);
-    if (output_count < 2)
+    const char *failure_response = NULL;
+    result = osg_site_usage_query(token_name, cmd_info->pathname, &usage, &free, &total, &failure_response);
+    if (result != GLOBUS_SUCCESS)
     {
-        result = GlobusGFSErrorGeneric("Invalid output from site usage script");
-        globus_gridftp_server_finished_command(op, result, "550 Invalid output from site usage script.\r\n");
+        globus_gridftp_server_finished_command(op, result, (char *)failure_response);
         return;
     }
-    if (output_count == 2) {total = usage + free;}
 
     char final_output[1024];
     snprintf(final_output, 1024, "250 USAGE %lld FREE %lld TOTAL %lld\r\n", usage, free, total);
@@ -453,11 +601,48 @@ osg_command(
     globus_gfs_command_info_t *         cmd_info,
     void *                              user_arg)
 {
+    // Any upload before this command has finished.
+    osg_quota_release();
+    osg_listing_cache_settle();
+
     switch (cmd_info->command)
     {
     case GLOBUS_GFS_OSG_CMD_SITE_USAGE:
         site_usage(op, cmd_info);
         return;
+    case GLOBUS_GFS_CMD_RNTO:
+        osg_listing_cache_invalidate_pending(cmd_info->from_pathname);
+        // fall through
+    case GLOBUS_GFS_CMD_MKD:
+    case GLOBUS_GFS_CMD_RMD:
+    case GLOBUS_GFS_CMD_DELE:
+    case GLOBUS_GFS_CMD_SITE_RDEL:
+    case GLOBUS_GFS_CMD_SITE_CHMOD:
+    case GLOBUS_GFS_CMD_SITE_CHGRP:
+    case GLOBUS_GFS_CMD_SITE_UTIME:
+    case GLOBUS_GFS_CMD_SITE_SYMLINK:
+    case GLOBUS_GFS_CMD_TRNC:
+        // A listing taken by another session while the command runs would
+        // miss the change, so invalidate again once it is done; the file
+        // DSI (the only one listings are cached for) finishes these before
+        // returning.
+        osg_listing_cache_invalidate_pending(cmd_info->pathname);
+        original_command_function(op, cmd_info, user_arg);
+        osg_listing_cache_settle();
+        return;
+    case GLOBUS_GFS_CMD_CKSM:
+        {
+            // Answer from the checksum computed during upload, if we have one.
+            char *cksm_value = NULL;
+            if (osg_checksum_lookup(cmd_info->pathname, cmd_info->cksm_alg,
+                                    cmd_info->cksm_offset, cmd_info->cksm_length, &cksm_value))
+            {
+                globus_gridftp_server_finished_command(op, GLOBUS_SUCCESS, cksm_value);
+                globus_free(cksm_value);
+                return;
+            }
+        }
+        break;
     default:
         // Anything not explicitly OSG-centric is passed to the
         // underlying module.
@@ -506,8 +691,29 @@ osg_activate(void)
     memcpy(&osg_dsi_iface, new_dsi, sizeof(globus_gfs_storage_iface_t));
     original_command_function = osg_dsi_iface.command_func;
     original_init_function = osg_dsi_iface.init_func;
+    original_destroy_function = osg_dsi_iface.destroy_func;
+    original_recv_function = osg_dsi_iface.recv_func;
+    original_send_function = osg_dsi_iface.send_func;
+    original_stat_function = osg_dsi_iface.stat_func;
     osg_dsi_iface.command_func = osg_command;
     osg_dsi_iface.init_func = osg_extensions_init;
+    osg_dsi_iface.destroy_func = osg_extensions_destroy;
+    osg_dsi_is_file = !strcmp(dsi_name, "file");
+    if (original_recv_function) {
+        osg_dsi_iface.recv_func = osg_recv;
+    }
+    if (original_send_function) {
+        osg_dsi_iface.send_func = osg_send;
+    }
+    if (original_stat_function) {
+        osg_dsi_iface.stat_func = osg_stat;
+    }
+    osg_buffer_pool_init();
+    osg_send_init();
+    osg_pressure_init();
+    osg_stat_init();
+    osg_listing_cache_init();
+    osg_cgroup_init();
 
     globus_extension_registry_add(
         GLOBUS_GFS_DSI_REGISTRY,
@@ -0,0 +1,317 @@
+
+#ifndef OSG_EXTENSIONS_H
+#define OSG_EXTENSIONS_H
+
+#include "globus_gridftp_server.h"
+
+// From globus_i_gridftp_server.h
+#define GlobusGFSErrorGenericStr(_res, _fmt)                           \
+do                                                                     \
+{                                                                      \
+        char *                          _tmp_str;                      \
+        _tmp_str = globus_common_create_string _fmt;                   \
+        _res = globus_error_put(                                       \
+            globus_error_construct_error(                              \
+                GLOBUS_NULL,                                           \
+                GLOBUS_NULL,                                           \
+                GLOBUS_GFS_ERROR_GENERIC,                              \
+                __FILE__,                                              \
+                _gfs_name,                                             \
+                __LINE__,                                              \
+                "%s",                                                  \
+                _tmp_str));                                            \
+        globus_free(_tmp_str);                                         \
+                                                                       \
+} while(0)
+
+/*
+ * Entry points of the underlying DSI; populated by osg_activate().
+ */
+extern globus_gfs_storage_transfer_t original_recv_function;
+extern globus_gfs_storage_transfer_t original_send_function;
+extern globus_gfs_storage_stat_t original_stat_function;
+
+/*
+ * Set when the underlying DSI is the built-in 'file' DSI.  The OSG-layer
+ * data paths operate directly on the local filesystem and are only used
+ * in that case.
+ */
+extern globus_bool_t osg_dsi_is_file;
+
+// Local username of this session; set by osg_extensions_init().
+extern char osg_session_username[256];
+
+globus_result_t
+osg_site_usage_query(const char *token_name, const char *pathname,
+                     long long *usage_p, long long *free_p, long long *total_p,
+                     const char **failure_response);
+
+/*************************************************************************
+ * osg_config.c: configuration helpers.
+ *************************************************************************/
+typedef struct {
+    globus_bool_t prealloc;
+    globus_off_t gather_size;
+    globus_off_t writebehind_size;
+} osg_write_policy_t;
+
+globus_off_t
+osg_parse_size(const char *value);
+
+// Is `pathname` equal to, or inside, the directory `prefix`?
+globus_bool_t
+osg_path_has_prefix(const char *pathname, const char *prefix);
+
+// Fill in the OSG_WRITE_POLICY rule applying to `pathname` (all off if none).
+void
+osg_write_policy_lookup(const char *pathname, osg_write_policy_t *policy);
+
+// OSG_SMALL_FILE_THRESHOLD in bytes; 0 if the small-file paths are off.
+globus_off_t
+osg_small_file_threshold(void);
+
+/*************************************************************************
+ * osg_admission.c: queue wait prediction for the transfer limits.
+ *************************************************************************/
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t releases;
+    double mean_hold;      // Seconds a slot is held, moving average.
+    double mean_interval;  // Seconds between releases, moving average.
+    double last_release;
+} osg_admission_stats_t;
+
+// OSG_QUEUE_MAX_WAIT and OSG_QUEUE_MAX_PREDICTED_WAIT, in seconds; the
+// latter is -1 (no early rejection) unless set.
+int
+osg_admission_max_wait(void);
+
+int
+osg_admission_max_predicted_wait(void);
+
+void
+osg_admission_stats_update(osg_admission_stats_t *stats, double hold_secs, double now);
+
+// Expected wait in seconds; 0 if there is no history yet.
+double
+osg_admission_predict_wait(const osg_admission_stats_t *stats, int limit, int waiters_ahead);
+
+double
+osg_admission_estimate(const char *sem_name, int limit, int waiters_ahead);
+
+void
+osg_admission_acquired(const char *sem_name, mode_t mode, int fd, int slot, int limit);
+
+// Record the end of this session's hold on its slots and drop them; called
+// when the session ends.
+void
+osg_admission_release(void);
+
+int
+osg_admission_waiter_join(int fd, int *waiters_ahead);
+
+void
+osg_admission_waiter_leave(int fd, int waiter);
+
+/*************************************************************************
+ * osg_cgroup.c: cgroup v2 placement of sessions.
+ *************************************************************************/
+// Starts the privileged placement helper; called once at activation.
+void
+osg_cgroup_init(void);
+
+// `vo` is the session's VO name, or "" if unknown.
+void
+osg_cgroup_join(const char *username, const char *vo);
+
+/*************************************************************************
+ * osg_recv.c: OSG-layer upload path.
+ *************************************************************************/
+void
+osg_recv(
+    globus_gfs_operation_t              op,
+    globus_gfs_transfer_info_t *        transfer_info,
+    void *                              user_arg);
+
+/*************************************************************************
+ * osg_pressure.c: storage back-pressure admission for uploads.
+ *************************************************************************/
+void
+osg_pressure_init(void);
+
+typedef void
+(*osg_pressure_callback_t)(
+    globus_gfs_operation_t              op,
+    globus_gfs_transfer_info_t *        transfer_info,
+    void *                              user_arg,
+    globus_result_t                     result);
+
+void
+osg_pressure_check(
+    globus_gfs_operation_t              op,
+    globus_gfs_transfer_info_t *        transfer_info,
+    void *                              user_arg,
+    osg_pressure_callback_t             callback);
+
+/*************************************************************************
+ * osg_quota.c: quota pre-check for uploads.
+ *************************************************************************/
+// `size` is the ALLO size, or -1 if unknown.
+globus_result_t
+osg_quota_check(const char *username, const char *pathname, globus_off_t size);
+
+// Drop this process's reservation, if any.  The admitted upload's quota is
+// then re-queried, since how much it wrote is unknown.
+void
+osg_quota_release(void);
+
+// As osg_quota_release(), for an upload known to have written `written`
+// bytes; they come off the cached free space.
+void
+osg_quota_finished(globus_off_t written);
+
+/*************************************************************************
+ * osg_send.c: OSG-layer download read pipeline.
+ *************************************************************************/
+// Reads the OSG_READ_PIPELINE configuration; called once at activation.
+void
+osg_send_init(void);
+
+void
+osg_send(
+    globus_gfs_operation_t              op,
+    globus_gfs_transfer_info_t *        transfer_info,
+    void *                              user_arg);
+
+/*************************************************************************
+ * osg_stat.c: bulk listing engine for large directories.
+ *************************************************************************/
+// Reads the OSG_BULK_STAT configuration; called once at activation.
+void
+osg_stat_init(void);
+
+void
+osg_stat(
+    globus_gfs_operation_t              op,
+    globus_gfs_stat_info_t *            stat_info,
+    void *                              user_arg);
+
+/*************************************************************************
+ * osg_listing_cache.c: per-account cache of directory listings.
+ *************************************************************************/
+typedef struct osg_listing_cache_s osg_listing_cache_t;
+
+void
+osg_listing_cache_init(void);
+
+globus_bool_t
+osg_listing_cache_enabled(void);
+
+// Cached listing of directory `pathname`, or NULL if there is no usable one.
+osg_listing_cache_t *
+osg_listing_cache_open(const char *pathname, globus_bool_t use_symlink_info, const struct stat *dir_st);
+
+// Returns the number of entries read (0 at the end), or -1 on a bad listing.
+int
+osg_listing_cache_read(osg_listing_cache_t *cache, globus_gfs_stat_t *entries, int max);
+
+void
+osg_listing_cache_close(osg_listing_cache_t *cache);
+
+// Single-file stat from the parent's cached listing; caller frees the strings.
+globus_bool_t
+osg_listing_cache_stat(const char *pathname, globus_bool_t use_symlink_info, globus_gfs_stat_t *entry);
+
+// Record a listing as it is produced; NULL if caching is off.
+osg_listing_cache_t *
+osg_listing_cache_begin(const char *pathname, globus_bool_t use_symlink_info, const struct stat *dir_st);
+
+void
+osg_listing_cache_append(osg_listing_cache_t *cache, const globus_gfs_stat_t *entries, int count);
+
+void
+osg_listing_cache_commit(osg_listing_cache_t *cache);
+
+void
+osg_listing_cache_abort(osg_listing_cache_t *cache);
+
+// Drop the listings of `pathname` and its parent directory.
+void
+osg_listing_cache_invalidate(const char *pathname);
+
+// As above, and again at osg_listing_cache_settle(), once the change is done.
+void
+osg_listing_cache_invalidate_pending(const char *pathname);
+
+void
+osg_listing_cache_settle(void);
+
+/*************************************************************************
+ * osg_buffer_pool.c: per-process pool of aligned data buffers.
+ *************************************************************************/
+void
+osg_buffer_pool_init(void);
+
+globus_byte_t *
+osg_buffer_get(globus_size_t size);
+
+// `size` must be the size originally requested from osg_buffer_get().
+void
+osg_buffer_put(globus_byte_t *buffer, globus_size_t size);
+
+/*************************************************************************
+ * osg_timing.c: session start-up latency breakdown.
+ *************************************************************************/
+typedef enum {
+    OSG_STARTUP_PHASE_ADD_COMMAND,
+    OSG_STARTUP_PHASE_VOMS,
+    OSG_STARTUP_PHASE_LIMITS_PARAMS,
+    OSG_STARTUP_PHASE_LIMITS_WAIT,
+    OSG_STARTUP_PHASE_CGROUP,
+    OSG_STARTUP_PHASE_DSI_INIT,
+    OSG_STARTUP_PHASE_COUNT
+} osg_startup_phase_t;
+
+typedef struct {
+    struct timespec start;
+    struct timespec last;
+    uint64_t phase_us[OSG_STARTUP_PHASE_COUNT];
+} osg_startup_timer_t;
+
+void
+osg_startup_timer_start(osg_startup_timer_t *timer);
+
+// Charge the time since the previous mark to `phase`.
+void
+osg_startup_timer_mark(osg_startup_timer_t *timer, osg_startup_phase_t phase);
+
+// Log the breakdown and add it to the host-wide histograms.
+void
+osg_startup_timer_report(const osg_startup_timer_t *timer, const char *username);
+
+/*************************************************************************
+ * osg_checksum.c: checksums computed while data is written.
+ *************************************************************************/
+typedef struct osg_checksum_s osg_checksum_t;
+
+// Returns NULL if OSG_INLINE_CHECKSUM names no supported algorithm.
+osg_checksum_t *
+osg_checksum_create(void);
+
+// Feed a range that has been written to `fd`; ranges may arrive in any order.
+void
+osg_checksum_update(osg_checksum_t *cksm, int fd, const globus_byte_t *buffer, globus_off_t offset, globus_size_t nbytes);
+
+// Finalize and remember the result for `pathname` if every byte was seen.
+void
+osg_checksum_finish(osg_checksum_t *cksm, int fd, const char *pathname);
+
+void
+osg_checksum_destroy(osg_checksum_t *cksm);
+
+// On a hit, returns GLOBUS_TRUE and a malloc'd checksum string.
+globus_bool_t
+osg_checksum_lookup(const char *pathname, const char *alg, globus_off_t offset, globus_off_t length, char **result);
+
+#endif  // OSG_EXTENSIONS_H
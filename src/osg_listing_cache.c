@@ -0,0 +1,718 @@
+
+#include "osg_extensions.h"
+
+#include <dirent.h>
+#include <libgen.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/*************************************************************************
+ * Directory listing cache
+ * -----------------------
+ * When OSG_LISTING_CACHE is set, listings produced by the listing engine
+ * (osg_stat.c) are cached per account: they are shared between the sessions
+ * of the same account on the host, not across accounts.  Each cached listing
+ * is a file in OSG_LISTING_CACHE_DIR (on /dev/shm by default) holding an
+ * osg_listing_cache_header_t, one record per entry, and an index of the
+ * records sorted by name hash, so a single-file stat reads only a few
+ * records even in a huge directory.
+ *
+ * A listing is only used while the directory's device, inode, mtime and
+ * ctime still match, and for at most OSG_LISTING_CACHE_TTL seconds (the
+ * attributes of the entries themselves can change without touching the
+ * directory).  Changes made through this server -- uploads, deletes,
+ * renames, and the other namespace commands -- remove the affected
+ * listings when they start and again once they are done, since another
+ * session may list the directory in between.  The size of each account's
+ * listings is kept under OSG_LISTING_CACHE_SIZE by evicting the oldest ones.
+ *
+ * Sessions run as many different users, so the cache directory is
+ * world-writable with the sticky bit set, and must be owned by root or the
+ * current user.  Listings are private (0600) to the account that wrote
+ * them and only trusted if owned by the current user; a session must still
+ * be able to read the directory (or, for a single file, search its parent)
+ * itself.  Since a session cannot remove another account's listings, an
+ * invalidation is also recorded in a shared table of invalidation times,
+ * indexed by the path hash; listings older than the entry are ignored.
+ *************************************************************************/
+
+#define OSG_LISTING_CACHE_MAGIC 0x4f53474c  // "OSGL"
+#define OSG_LISTING_CACHE_VERSION 2
+#define OSG_LISTING_CACHE_DEFAULT_DIR "/dev/shm/gridftp-osg-listing-cache"
+#define OSG_LISTING_CACHE_DEFAULT_TTL 30
+#define OSG_LISTING_CACHE_DEFAULT_SIZE (256*1024*1024)
+// Abandoned temporary files older than this are removed during eviction.
+#define OSG_LISTING_CACHE_TMP_AGE 3600
+#define OSG_LISTING_CACHE_INVALIDATIONS ".invalidations"
+#define OSG_LISTING_CACHE_INVALIDATION_SLOTS 4096
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    int64_t created;
+    uint32_t use_symlink_info;
+    uint32_t count;
+    uint64_t index_offset;  // `count` osg_listing_cache_index_t entries
+    char path[PATH_MAX];
+} osg_listing_cache_header_t;
+
+typedef struct {
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    int64_t size;
+    int64_t atime;
+    int64_t mtime;
+    int64_t ctime;
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t name_len;
+    uint32_t target_len;
+} osg_listing_cache_record_t;
+
+typedef struct {
+    uint64_t hash;          // of the entry name
+    uint64_t offset;        // of its record
+} osg_listing_cache_index_t;
+
+struct osg_listing_cache_s {
+    FILE *fp;
+    uint32_t remaining;
+    // Writers only.
+    osg_listing_cache_header_t header;
+    char tmp_name[PATH_MAX];
+    char final_name[PATH_MAX];
+    globus_off_t written;
+    globus_bool_t failed;
+    osg_listing_cache_index_t *index;
+    size_t index_alloc;
+};
+
+static globus_bool_t osg_listing_cache_on = GLOBUS_FALSE;
+static const char *osg_listing_cache_dir = OSG_LISTING_CACHE_DEFAULT_DIR;
+static int osg_listing_cache_ttl = OSG_LISTING_CACHE_DEFAULT_TTL;
+static globus_off_t osg_listing_cache_size = OSG_LISTING_CACHE_DEFAULT_SIZE;
+// Time of the last invalidation of each path hash (modulo the table size).
+static volatile int64_t *osg_listing_cache_invalidations = NULL;
+// Paths changed by requests left to the underlying DSI, whose completion
+// we do not see (a rename changes two).
+static char *osg_listing_cache_pending[2] = {NULL, NULL};
+
+
+void
+osg_listing_cache_init(void)
+{
+    if (!getenv("OSG_LISTING_CACHE")) {return;}
+
+    const char *dir_char = getenv("OSG_LISTING_CACHE_DIR");
+    if (dir_char && *dir_char) {osg_listing_cache_dir = dir_char;}
+    const char *ttl_char = getenv("OSG_LISTING_CACHE_TTL");
+    if (ttl_char) {osg_listing_cache_ttl = atoi(ttl_char);}
+    const char *size_char = getenv("OSG_LISTING_CACHE_SIZE");
+    if (size_char) {osg_listing_cache_size = osg_parse_size(size_char);}
+    if ((osg_listing_cache_ttl <= 0) || (osg_listing_cache_size <= 0)) {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Invalid listing cache TTL or size; listing cache disabled.\n");
+        return;
+    }
+
+    // Sessions run as many different users, all of whom need to add
+    // listings; the sticky bit stops them removing each other's.
+    if (mkdir(osg_listing_cache_dir, 01777) == 0) {
+        chmod(osg_listing_cache_dir, 01777);
+    } else if (errno != EEXIST) {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Unable to create listing cache %s: %s\n", osg_listing_cache_dir, strerror(errno));
+        return;
+    }
+    struct stat st;
+    // A directory left by an older version may lack the sticky bit.
+    if ((lstat(osg_listing_cache_dir, &st) == 0) && S_ISDIR(st.st_mode) &&
+        (st.st_uid == geteuid()) && ((st.st_mode & 07777) == 0777))
+    {
+        chmod(osg_listing_cache_dir, 01777);
+    }
+    if ((lstat(osg_listing_cache_dir, &st) == -1) || !S_ISDIR(st.st_mode) ||
+        ((st.st_uid != 0) && (st.st_uid != geteuid())) ||
+        ((st.st_mode & S_IWOTH) && !(st.st_mode & S_ISVTX)))
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Listing cache %s must be a directory owned by root or the server user, "
+            "and sticky if world-writable; listing cache disabled.\n", osg_listing_cache_dir);
+        return;
+    }
+
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s/%s", osg_listing_cache_dir, OSG_LISTING_CACHE_INVALIDATIONS);
+    name[sizeof(name)-1] = '\0';
+    size_t table_size = OSG_LISTING_CACHE_INVALIDATION_SLOTS * sizeof(int64_t);
+    int fd = open(name, O_RDWR | O_CREAT | O_NOFOLLOW, 0666);
+    if (fd != -1) {fchmod(fd, 0666);}
+    if ((fd == -1) || (fstat(fd, &st) == -1) || !S_ISREG(st.st_mode) ||
+        (((size_t)st.st_size < table_size) && (ftruncate(fd, table_size) == -1)))
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Unable to open listing cache invalidations %s; listing cache disabled.\n", name);
+        if (fd != -1) {close(fd);}
+        return;
+    }
+    void *table = mmap(NULL, table_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) {return;}
+    osg_listing_cache_invalidations = (volatile int64_t *)table;
+    osg_listing_cache_on = GLOBUS_TRUE;
+}
+
+
+globus_bool_t
+osg_listing_cache_enabled(void)
+{
+    return osg_listing_cache_on;
+}
+
+
+static uint64_t
+listing_cache_hash(const char *pathname)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    const char *pos;
+    for (pos = pathname; *pos; pos++) {
+        hash ^= (unsigned char)*pos;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+static void
+listing_cache_name(const char *pathname, globus_bool_t use_symlink_info, char *name, size_t name_len)
+{
+    snprintf(name, name_len, "%s/%016llx-%d", osg_listing_cache_dir,
+             (unsigned long long)listing_cache_hash(pathname), use_symlink_info ? 1 : 0);
+    name[name_len-1] = '\0';
+}
+
+
+static volatile int64_t *
+listing_cache_invalidation(const char *pathname)
+{
+    return &osg_listing_cache_invalidations[listing_cache_hash(pathname) % OSG_LISTING_CACHE_INVALIDATION_SLOTS];
+}
+
+
+// Open the cached listing file `name`, if it is ours to trust.
+static int
+listing_cache_open_file(const char *name)
+{
+    int fd = open(name, O_RDONLY | O_NOFOLLOW);
+    if (fd == -1) {return -1;}
+    struct stat st;
+    if ((fstat(fd, &st) == -1) || !S_ISREG(st.st_mode) || (st.st_uid != geteuid())) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+static globus_bool_t
+listing_cache_matches(const osg_listing_cache_header_t *header, const char *pathname,
+                      globus_bool_t use_symlink_info, const struct stat *dir_st)
+{
+    return (header->magic == OSG_LISTING_CACHE_MAGIC) &&
+           (header->version == OSG_LISTING_CACHE_VERSION) &&
+           (header->use_symlink_info == (use_symlink_info ? 1 : 0)) &&
+           (header->dev == (uint64_t)dir_st->st_dev) &&
+           (header->ino == (uint64_t)dir_st->st_ino) &&
+           (header->mtime_sec == dir_st->st_mtim.tv_sec) &&
+           (header->mtime_nsec == dir_st->st_mtim.tv_nsec) &&
+           (header->ctime_sec == dir_st->st_ctim.tv_sec) &&
+           (header->ctime_nsec == dir_st->st_ctim.tv_nsec) &&
+           (time(NULL) - header->created < osg_listing_cache_ttl) &&
+           (*listing_cache_invalidation(pathname) < header->created) &&
+           !strncmp(header->path, pathname, sizeof(header->path));
+}
+
+
+/*************************************************************************
+ * osg_listing_cache_open
+ * ----------------------
+ * Open the cached listing of directory `pathname` (whose current attributes
+ * are `dir_st`), or return NULL if there is no usable one.
+ *************************************************************************/
+osg_listing_cache_t *
+osg_listing_cache_open(const char *pathname, globus_bool_t use_symlink_info, const struct stat *dir_st)
+{
+    if (!osg_listing_cache_on) {return NULL;}
+    if (faccessat(AT_FDCWD, pathname, R_OK | X_OK, AT_EACCESS) == -1) {return NULL;}
+
+    char name[PATH_MAX];
+    listing_cache_name(pathname, use_symlink_info, name, sizeof(name));
+    int fd = listing_cache_open_file(name);
+    if (fd == -1) {return NULL;}
+
+    osg_listing_cache_t *cache = (osg_listing_cache_t *)globus_calloc(1, sizeof(osg_listing_cache_t));
+    if (!cache) {
+        close(fd);
+        return NULL;
+    }
+    cache->fp = fdopen(fd, "r");
+    if (!cache->fp) {
+        close(fd);
+        globus_free(cache);
+        return NULL;
+    }
+    if ((fread(&cache->header, sizeof(cache->header), 1, cache->fp) != 1) ||
+        !listing_cache_matches(&cache->header, pathname, use_symlink_info, dir_st))
+    {
+        osg_listing_cache_close(cache);
+        return NULL;
+    }
+    cache->remaining = cache->header.count;
+    return cache;
+}
+
+
+/*
+ * Read up to `max` entries; returns the number read, or -1 if the cached
+ * listing turned out to be truncated.
+ */
+int
+osg_listing_cache_read(osg_listing_cache_t *cache, globus_gfs_stat_t *entries, int max)
+{
+    int count = 0;
+    while ((count < max) && cache->remaining) {
+        osg_listing_cache_record_t record;
+        if ((fread(&record, sizeof(record), 1, cache->fp) != 1) ||
+            (record.name_len >= PATH_MAX) || (record.target_len >= PATH_MAX))
+        {
+            return -1;
+        }
+        globus_gfs_stat_t *entry = &entries[count];
+        memset(entry, '\0', sizeof(*entry));
+        entry->name = (char *)globus_malloc(record.name_len + 1);
+        entry->symlink_target = record.target_len ? (char *)globus_malloc(record.target_len + 1) : NULL;
+        if (!entry->name || (record.target_len && !entry->symlink_target) ||
+            (fread(entry->name, 1, record.name_len, cache->fp) != record.name_len) ||
+            (record.target_len && (fread(entry->symlink_target, 1, record.target_len, cache->fp) != record.target_len)))
+        {
+            if (entry->name) {globus_free(entry->name);}
+            if (entry->symlink_target) {globus_free(entry->symlink_target);}
+            entry->name = entry->symlink_target = NULL;
+            return -1;
+        }
+        entry->name[record.name_len] = '\0';
+        if (entry->symlink_target) {entry->symlink_target[record.target_len] = '\0';}
+        entry->mode = record.mode;
+        entry->nlink = record.nlink;
+        entry->uid = record.uid;
+        entry->gid = record.gid;
+        entry->size = record.size;
+        entry->atime = record.atime;
+        entry->mtime = record.mtime;
+        entry->ctime = record.ctime;
+        entry->dev = record.dev;
+        entry->ino = record.ino;
+        count++;
+        cache->remaining--;
+    }
+    return count;
+}
+
+
+void
+osg_listing_cache_close(osg_listing_cache_t *cache)
+{
+    if (!cache) {return;}
+    fclose(cache->fp);
+    globus_free(cache);
+}
+
+
+/*************************************************************************
+ * osg_listing_cache_stat
+ * ----------------------
+ * Answer a single-file stat of `pathname` from the cached listing of its
+ * parent directory.  Returns GLOBUS_TRUE and fills in `entry` on a hit.
+ *************************************************************************/
+globus_bool_t
+osg_listing_cache_stat(const char *pathname, globus_bool_t use_symlink_info, globus_gfs_stat_t *entry)
+{
+    if (!osg_listing_cache_on) {return GLOBUS_FALSE;}
+
+    char parent[PATH_MAX];
+    strncpy(parent, pathname, sizeof(parent) - 1);
+    parent[sizeof(parent)-1] = '\0';
+    const char *base = strrchr(pathname, '/');
+    if (!base || !base[1] || !strcmp(base, "/.") || !strcmp(base, "/..")) {return GLOBUS_FALSE;}
+    base++;
+    if (base - pathname == 1) {
+        strcpy(parent, "/");
+    } else {
+        parent[base - pathname - 1] = '\0';
+    }
+
+    // Looking up an entry needs only search permission on the parent.
+    struct stat dir_st;
+    if ((stat(parent, &dir_st) == -1) || !S_ISDIR(dir_st.st_mode) ||
+        (faccessat(AT_FDCWD, parent, X_OK, AT_EACCESS) == -1))
+    {
+        return GLOBUS_FALSE;
+    }
+    char name[PATH_MAX];
+    listing_cache_name(parent, use_symlink_info, name, sizeof(name));
+    int fd = listing_cache_open_file(name);
+    if (fd == -1) {return GLOBUS_FALSE;}
+    osg_listing_cache_t cache;
+    memset(&cache, '\0', sizeof(cache));
+    cache.fp = fdopen(fd, "r");
+    if (!cache.fp) {
+        close(fd);
+        return GLOBUS_FALSE;
+    }
+    globus_bool_t found = GLOBUS_FALSE;
+    if ((fread(&cache.header, sizeof(cache.header), 1, cache.fp) != 1) ||
+        !listing_cache_matches(&cache.header, parent, use_symlink_info, &dir_st))
+    {
+        fclose(cache.fp);
+        return GLOBUS_FALSE;
+    }
+
+    // Find the first index entry with the name's hash, then check each
+    // record with that hash.
+    uint64_t hash = listing_cache_hash(base);
+    osg_listing_cache_index_t slot;
+    uint32_t low = 0, high = cache.header.count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if ((fseeko(cache.fp, cache.header.index_offset + (off_t)mid * sizeof(slot), SEEK_SET) == -1) ||
+            (fread(&slot, sizeof(slot), 1, cache.fp) != 1))
+        {
+            fclose(cache.fp);
+            return GLOBUS_FALSE;
+        }
+        if (slot.hash < hash) {low = mid + 1;} else {high = mid;}
+    }
+    for (; !found && (low < cache.header.count); low++) {
+        if ((fseeko(cache.fp, cache.header.index_offset + (off_t)low * sizeof(slot), SEEK_SET) == -1) ||
+            (fread(&slot, sizeof(slot), 1, cache.fp) != 1) || (slot.hash != hash) ||
+            (fseeko(cache.fp, slot.offset, SEEK_SET) == -1))
+        {
+            break;
+        }
+        cache.remaining = 1;
+        if (osg_listing_cache_read(&cache, entry, 1) != 1) {break;}
+        found = !strcmp(entry->name, base);
+        if (!found) {
+            globus_free(entry->name);
+            if (entry->symlink_target) {globus_free(entry->symlink_target);}
+        }
+    }
+    fclose(cache.fp);
+    return found;
+}
+
+
+/*************************************************************************
+ * osg_listing_cache_begin
+ * -----------------------
+ * Start recording the listing of directory `pathname`, whose attributes
+ * were `dir_st` before it was read.  Returns NULL if caching is off.
+ *************************************************************************/
+osg_listing_cache_t *
+osg_listing_cache_begin(const char *pathname, globus_bool_t use_symlink_info, const struct stat *dir_st)
+{
+    if (!osg_listing_cache_on || (strlen(pathname) >= PATH_MAX)) {return NULL;}
+
+    osg_listing_cache_t *cache = (osg_listing_cache_t *)globus_calloc(1, sizeof(osg_listing_cache_t));
+    if (!cache) {return NULL;}
+    snprintf(cache->tmp_name, sizeof(cache->tmp_name), "%s/.tmp.XXXXXX", osg_listing_cache_dir);
+    // mkstemp() creates the file 0600, private to this account.
+    int fd = mkstemp(cache->tmp_name);
+    if (fd == -1) {
+        globus_free(cache);
+        return NULL;
+    }
+    cache->fp = fdopen(fd, "w");
+    if (!cache->fp) {
+        close(fd);
+        unlink(cache->tmp_name);
+        globus_free(cache);
+        return NULL;
+    }
+    listing_cache_name(pathname, use_symlink_info, cache->final_name, sizeof(cache->final_name));
+
+    osg_listing_cache_header_t *header = &cache->header;
+    header->magic = OSG_LISTING_CACHE_MAGIC;
+    header->version = OSG_LISTING_CACHE_VERSION;
+    header->dev = dir_st->st_dev;
+    header->ino = dir_st->st_ino;
+    header->mtime_sec = dir_st->st_mtim.tv_sec;
+    header->mtime_nsec = dir_st->st_mtim.tv_nsec;
+    header->ctime_sec = dir_st->st_ctim.tv_sec;
+    header->ctime_nsec = dir_st->st_ctim.tv_nsec;
+    header->created = time(NULL);
+    header->use_symlink_info = use_symlink_info ? 1 : 0;
+    strncpy(header->path, pathname, sizeof(header->path) - 1);
+
+    // The header is rewritten with the final count on commit.
+    cache->failed = fwrite(header, sizeof(*header), 1, cache->fp) != 1;
+    cache->written = sizeof(*header);
+    return cache;
+}
+
+
+void
+osg_listing_cache_append(osg_listing_cache_t *cache, const globus_gfs_stat_t *entries, int count)
+{
+    if (!cache || cache->failed) {return;}
+
+    int idx;
+    for (idx = 0; idx < count; idx++) {
+        const globus_gfs_stat_t *entry = &entries[idx];
+        if (cache->header.count == cache->index_alloc) {
+            size_t new_alloc = cache->index_alloc ? 2 * cache->index_alloc : 1024;
+            osg_listing_cache_index_t *new_index = (osg_listing_cache_index_t *)globus_realloc(cache->index,
+                new_alloc * sizeof(*cache->index));
+            if (!new_index) {
+                cache->failed = GLOBUS_TRUE;
+                return;
+            }
+            cache->index = new_index;
+            cache->index_alloc = new_alloc;
+        }
+        cache->index[cache->header.count].hash = listing_cache_hash(entry->name);
+        cache->index[cache->header.count].offset = cache->written;
+
+        osg_listing_cache_record_t record;
+        memset(&record, '\0', sizeof(record));
+        record.mode = entry->mode;
+        record.nlink = entry->nlink;
+        record.uid = entry->uid;
+        record.gid = entry->gid;
+        record.size = entry->size;
+        record.atime = entry->atime;
+        record.mtime = entry->mtime;
+        record.ctime = entry->ctime;
+        record.dev = entry->dev;
+        record.ino = entry->ino;
+        record.name_len = strlen(entry->name);
+        record.target_len = entry->symlink_target ? strlen(entry->symlink_target) : 0;
+        if ((fwrite(&record, sizeof(record), 1, cache->fp) != 1) ||
+            (fwrite(entry->name, 1, record.name_len, cache->fp) != record.name_len) ||
+            (record.target_len && (fwrite(entry->symlink_target, 1, record.target_len, cache->fp) != record.target_len)))
+        {
+            cache->failed = GLOBUS_TRUE;
+            return;
+        }
+        cache->written += sizeof(record) + record.name_len + record.target_len;
+        cache->header.count++;
+    }
+    // A listing too large for the whole cache (with its index) is not worth keeping.
+    if (cache->written + (globus_off_t)(cache->header.count * sizeof(*cache->index)) > osg_listing_cache_size) {
+        cache->failed = GLOBUS_TRUE;
+    }
+}
+
+
+void
+osg_listing_cache_abort(osg_listing_cache_t *cache)
+{
+    if (!cache) {return;}
+    fclose(cache->fp);
+    unlink(cache->tmp_name);
+    if (cache->index) {globus_free(cache->index);}
+    globus_free(cache);
+}
+
+
+static int
+listing_cache_index_cmp(const void *left, const void *right)
+{
+    uint64_t left_hash = ((const osg_listing_cache_index_t *)left)->hash;
+    uint64_t right_hash = ((const osg_listing_cache_index_t *)right)->hash;
+    return (left_hash > right_hash) - (left_hash < right_hash);
+}
+
+
+typedef struct {
+    char name[64];
+    time_t mtime;
+    off_t size;
+} osg_listing_cache_file_t;
+
+
+static int
+listing_cache_file_cmp(const void *left, const void *right)
+{
+    time_t left_mtime = ((const osg_listing_cache_file_t *)left)->mtime;
+    time_t right_mtime = ((const osg_listing_cache_file_t *)right)->mtime;
+    return (left_mtime > right_mtime) - (left_mtime < right_mtime);
+}
+
+
+/*
+ * Remove this account's expired listings, then its oldest ones until they
+ * fit within OSG_LISTING_CACHE_SIZE.  Other accounts' files cannot be
+ * removed from the sticky directory, so they are not counted.
+ */
+static void
+listing_cache_evict(void)
+{
+    DIR *dir = opendir(osg_listing_cache_dir);
+    if (!dir) {return;}
+
+    time_t now = time(NULL);
+    size_t file_count = 0, file_alloc = 0;
+    osg_listing_cache_file_t *files = NULL;
+    globus_off_t total = 0;
+    struct dirent *dent;
+    while ((dent = readdir(dir))) {
+        if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, "..") ||
+            (strlen(dent->d_name) >= sizeof(files->name)))
+        {
+            continue;
+        }
+        struct stat st;
+        if (!strcmp(dent->d_name, OSG_LISTING_CACHE_INVALIDATIONS) ||
+            (fstatat(dirfd(dir), dent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) ||
+            (st.st_uid != geteuid()))
+        {
+            continue;
+        }
+        globus_bool_t is_tmp = !strncmp(dent->d_name, ".tmp.", 5);
+        if (now - st.st_mtime >= (is_tmp ? OSG_LISTING_CACHE_TMP_AGE : osg_listing_cache_ttl)) {
+            unlinkat(dirfd(dir), dent->d_name, 0);
+            continue;
+        }
+        total += st.st_size;
+        if (is_tmp) {continue;}
+        if (file_count == file_alloc) {
+            size_t new_alloc = file_alloc ? 2 * file_alloc : 64;
+            osg_listing_cache_file_t *new_files = (osg_listing_cache_file_t *)globus_realloc(files, new_alloc * sizeof(*files));
+            if (!new_files) {break;}
+            files = new_files;
+            file_alloc = new_alloc;
+        }
+        strcpy(files[file_count].name, dent->d_name);
+        files[file_count].mtime = st.st_mtime;
+        files[file_count].size = st.st_size;
+        file_count++;
+    }
+
+    if (total > osg_listing_cache_size) {
+        qsort(files, file_count, sizeof(*files), listing_cache_file_cmp);
+        size_t idx;
+        for (idx = 0; (idx < file_count) && (total > osg_listing_cache_size); idx++) {
+            if (unlinkat(dirfd(dir), files[idx].name, 0) == 0) {total -= files[idx].size;}
+        }
+    }
+    if (files) {globus_free(files);}
+    closedir(dir);
+}
+
+
+/*************************************************************************
+ * osg_listing_cache_commit
+ * ------------------------
+ * Publish a completed listing, unless the directory changed while it was
+ * being read.
+ *************************************************************************/
+void
+osg_listing_cache_commit(osg_listing_cache_t *cache)
+{
+    if (!cache) {return;}
+
+    if (!cache->failed && cache->header.count) {
+        qsort(cache->index, cache->header.count, sizeof(*cache->index), listing_cache_index_cmp);
+        cache->failed = fwrite(cache->index, sizeof(*cache->index), cache->header.count, cache->fp) != cache->header.count;
+    }
+    cache->header.index_offset = cache->written;
+
+    struct stat dir_st;
+    if (cache->failed || (fflush(cache->fp) != 0) ||
+        (stat(cache->header.path, &dir_st) == -1) ||
+        (cache->header.mtime_sec != dir_st.st_mtim.tv_sec) ||
+        (cache->header.mtime_nsec != dir_st.st_mtim.tv_nsec) ||
+        (cache->header.ctime_sec != dir_st.st_ctim.tv_sec) ||
+        (cache->header.ctime_nsec != dir_st.st_ctim.tv_nsec) ||
+        (pwrite(fileno(cache->fp), &cache->header, sizeof(cache->header), 0) != sizeof(cache->header)) ||
+        (rename(cache->tmp_name, cache->final_name) == -1))
+    {
+        osg_listing_cache_abort(cache);
+        return;
+    }
+    fclose(cache->fp);
+    if (cache->index) {globus_free(cache->index);}
+    globus_free(cache);
+
+    listing_cache_evict();
+}
+
+
+/*************************************************************************
+ * osg_listing_cache_invalidate
+ * ----------------------------
+ * Forget any listing of `pathname` and of the directory containing it,
+ * whichever account wrote it.
+ *************************************************************************/
+void
+osg_listing_cache_invalidate(const char *pathname)
+{
+    if (!osg_listing_cache_on || !pathname) {return;}
+
+    char parent[PATH_MAX];
+    strncpy(parent, pathname, sizeof(parent) - 1);
+    parent[sizeof(parent)-1] = '\0';
+    dirname(parent);
+
+    // Listings are stamped in whole seconds, so a listing made later in
+    // this second is also ignored; that only costs a cache miss.
+    int64_t now = time(NULL);
+    *listing_cache_invalidation(pathname) = now;
+    *listing_cache_invalidation(parent) = now;
+
+    char name[PATH_MAX];
+    int use_symlink_info;
+    for (use_symlink_info = 0; use_symlink_info < 2; use_symlink_info++) {
+        listing_cache_name(pathname, use_symlink_info, name, sizeof(name));
+        unlink(name);
+        listing_cache_name(parent, use_symlink_info, name, sizeof(name));
+        unlink(name);
+    }
+}
+
+
+/*************************************************************************
+ * osg_listing_cache_invalidate_pending
+ * ------------------------------------
+ * Invalidate `pathname` now and again at the next osg_listing_cache_settle(),
+ * for a change the underlying DSI completes after this returns; listings
+ * taken while it runs would otherwise be served until they expire.
+ *************************************************************************/
+void
+osg_listing_cache_invalidate_pending(const char *pathname)
+{
+    if (!osg_listing_cache_on || !pathname) {return;}
+
+    if (osg_listing_cache_pending[1]) {osg_listing_cache_settle();}
+    osg_listing_cache_invalidate(pathname);
+    osg_listing_cache_pending[osg_listing_cache_pending[0] ? 1 : 0] = globus_libc_strdup(pathname);
+}
+
+
+// The session moved on (or ended), so any pending change has completed.
+void
+osg_listing_cache_settle(void)
+{
+    int idx;
+    for (idx = 0; idx < 2; idx++) {
+        if (!osg_listing_cache_pending[idx]) {continue;}
+        osg_listing_cache_invalidate(osg_listing_cache_pending[idx]);
+        globus_free(osg_listing_cache_pending[idx]);
+        osg_listing_cache_pending[idx] = NULL;
+    }
+}
@@ -0,0 +1,471 @@
+
+#include "osg_extensions.h"
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#include <sched.h>
+#include <stddef.h>
+#include <string.h>
+
+/*************************************************************************
+ * Storage back-pressure
+ * ---------------------
+ * Before an upload starts, check cheap host-wide signals and defer or
+ * reject it if the storage cannot take the data:
+ *  - OSG_STORAGE_MIN_FREE="/mnt/data=50G;/scratch=5%": minimum free space
+ *    (bytes or percent of the filesystem) for uploads under each mount.
+ *  - OSG_STORAGE_DEVICES="sdb=/mnt/data,nvme0n1": block devices whose
+ *    utilization (OSG_STORAGE_MAX_UTIL, percent) and number of in-flight
+ *    requests (OSG_STORAGE_MAX_QUEUE) are checked from /proc/diskstats.  A
+ *    device given as `name=path` only holds back uploads beneath `path`.
+ *
+ * Every session process would otherwise poll the same counters, so the
+ * samples live in a shared file (OSG_STORAGE_PRESSURE_FILE with the uid of
+ * the account appended).  Whichever process first notices the sample is
+ * older than OSG_STORAGE_SAMPLE_INTERVAL seconds takes the file lock and
+ * refreshes it; everyone else just reads.  The file is mode 0644 and is only
+ * used if the account owns it, so other local users cannot feed uploads
+ * fake numbers; if it cannot be used, the process samples on its own.
+ * Utilization is the busy time between two samples; if the previous one is
+ * too old to say anything about the device now (the server was idle), the
+ * refresh only records a new baseline and the measurement completes
+ * OSG_PRESSURE_MIN_WINDOW_MS later.
+ *
+ * Waiting uploads are re-checked from a timer callback rather than by
+ * sleeping, so a non-threaded server keeps serving other requests.
+ *************************************************************************/
+
+#define OSG_PRESSURE_MAGIC 0x4f535051  // "OSPQ"
+#define OSG_PRESSURE_MAX_MOUNTS 16
+#define OSG_PRESSURE_MAX_DEVICES 16
+#define OSG_PRESSURE_DEFAULT_FILE "/dev/shm/gridftp-osg-storage-pressure"
+#define OSG_PRESSURE_DEFAULT_INTERVAL 5
+#define OSG_PRESSURE_MIN_WINDOW_MS 250
+
+typedef struct {
+    char path[256];
+    uint64_t free_bytes;
+    uint64_t total_bytes;
+    int error;
+} osg_pressure_mount_t;
+
+typedef struct {
+    char name[32];
+    uint64_t io_ticks;      // milliseconds spent doing I/O (diskstats field 13)
+    uint64_t in_flight;     // requests currently in flight (diskstats field 12)
+    double utilization;     // percent, over the last sample interval; -1 if unknown
+    int found;
+} osg_pressure_device_t;
+
+typedef struct {
+    uint32_t magic;
+    volatile uint32_t seq;  // odd while a sample is being written
+    struct timespec sampled;
+    uint32_t mount_count;
+    uint32_t device_count;
+    uint32_t measuring;     // some utilization is still unknown
+    osg_pressure_mount_t mounts[OSG_PRESSURE_MAX_MOUNTS];
+    osg_pressure_device_t devices[OSG_PRESSURE_MAX_DEVICES];
+} osg_pressure_sample_t;
+
+typedef struct {
+    char path[256];
+    globus_off_t min_bytes;
+    int min_percent;
+} osg_pressure_min_free_t;
+
+// An upload waiting for the storage to recover.
+typedef struct {
+    globus_gfs_operation_t op;
+    globus_gfs_transfer_info_t *transfer_info;
+    void *user_arg;
+    osg_pressure_callback_t callback;
+    struct timespec start;
+} osg_pressure_waiter_t;
+
+
+static globus_bool_t osg_pressure_configured = GLOBUS_FALSE;
+static int osg_pressure_mount_count = 0;
+static osg_pressure_min_free_t osg_pressure_min_free[OSG_PRESSURE_MAX_MOUNTS];
+static int osg_pressure_device_count = 0;
+static char osg_pressure_devices[OSG_PRESSURE_MAX_DEVICES][32];
+static char osg_pressure_device_paths[OSG_PRESSURE_MAX_DEVICES][256];  // empty: all uploads
+static int osg_pressure_max_util = -1;
+static int osg_pressure_max_queue = -1;
+static int osg_pressure_interval = OSG_PRESSURE_DEFAULT_INTERVAL;
+static int osg_pressure_wait = 0;
+static const char *osg_pressure_file = OSG_PRESSURE_DEFAULT_FILE;
+
+
+void
+osg_pressure_init(void)
+{
+    const char *min_free = getenv("OSG_STORAGE_MIN_FREE");
+    if (min_free) {
+        char *rules = globus_libc_strdup(min_free);
+        char *saveptr = NULL;
+        char *rule;
+        for (rule = rules ? strtok_r(rules, ";", &saveptr) : NULL; rule; rule = strtok_r(NULL, ";", &saveptr)) {
+            char *value = strrchr(rule, '=');
+            if (!value || (osg_pressure_mount_count == OSG_PRESSURE_MAX_MOUNTS)) {continue;}
+            *value++ = '\0';
+            while (isspace(*rule)) {rule++;}
+            osg_pressure_min_free_t *entry = &osg_pressure_min_free[osg_pressure_mount_count];
+            memset(entry, '\0', sizeof(*entry));
+            strncpy(entry->path, rule, 255);
+            size_t value_len = strlen(value);
+            if (value_len && (value[value_len-1] == '%')) {
+                entry->min_percent = atoi(value);
+            } else if ((entry->min_bytes = osg_parse_size(value)) < 0) {
+                globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Ignoring invalid minimum free space %s for %s.\n", value, rule);
+                continue;
+            }
+            osg_pressure_mount_count++;
+        }
+        if (rules) {globus_free(rules);}
+    }
+
+    const char *devices = getenv("OSG_STORAGE_DEVICES");
+    if (devices) {
+        char *names = globus_libc_strdup(devices);
+        char *saveptr = NULL;
+        char *name;
+        for (name = names ? strtok_r(names, ", ", &saveptr) : NULL; name; name = strtok_r(NULL, ", ", &saveptr)) {
+            if (osg_pressure_device_count == OSG_PRESSURE_MAX_DEVICES) {break;}
+            char *path = strchr(name, '=');
+            if (path) {*path++ = '\0';}
+            strncpy(osg_pressure_devices[osg_pressure_device_count], name, 31);
+            osg_pressure_devices[osg_pressure_device_count][31] = '\0';
+            strncpy(osg_pressure_device_paths[osg_pressure_device_count], path ? path : "", 255);
+            osg_pressure_device_paths[osg_pressure_device_count][255] = '\0';
+            osg_pressure_device_count++;
+        }
+        if (names) {globus_free(names);}
+    }
+
+    const char *value;
+    if ((value = getenv("OSG_STORAGE_MAX_UTIL"))) {osg_pressure_max_util = atoi(value);}
+    if ((value = getenv("OSG_STORAGE_MAX_QUEUE"))) {osg_pressure_max_queue = atoi(value);}
+    if ((value = getenv("OSG_STORAGE_SAMPLE_INTERVAL")) && (atoi(value) > 0)) {osg_pressure_interval = atoi(value);}
+    if ((value = getenv("OSG_STORAGE_PRESSURE_WAIT"))) {osg_pressure_wait = atoi(value);}
+    if ((value = getenv("OSG_STORAGE_PRESSURE_FILE"))) {osg_pressure_file = value;}
+
+    if (osg_pressure_device_count && (osg_pressure_max_util < 0) && (osg_pressure_max_queue < 0)) {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "OSG_STORAGE_DEVICES set without OSG_STORAGE_MAX_UTIL or OSG_STORAGE_MAX_QUEUE; ignoring.\n");
+        osg_pressure_device_count = 0;
+    }
+    osg_pressure_configured = osg_pressure_mount_count || osg_pressure_device_count;
+}
+
+
+static double
+pressure_elapsed_ms(const struct timespec *since, const struct timespec *now)
+{
+    return (now->tv_sec - since->tv_sec) * 1000.0 + (now->tv_nsec - since->tv_nsec) / 1e6;
+}
+
+
+/*
+ * Take a fresh sample into `sample`, using the device counters of the
+ * previous sample to compute utilization.  A previous sample more than two
+ * intervals old (refreshes normally come every interval) would average the
+ * busy time over the idle period, so it is not used.
+ */
+static void
+pressure_sample(osg_pressure_sample_t *sample)
+{
+    osg_pressure_sample_t previous = *sample;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    sample->mount_count = osg_pressure_mount_count;
+    int idx;
+    for (idx = 0; idx < osg_pressure_mount_count; idx++) {
+        osg_pressure_mount_t *mount = &sample->mounts[idx];
+        memset(mount, '\0', sizeof(*mount));
+        strncpy(mount->path, osg_pressure_min_free[idx].path, 255);
+        struct statvfs vfs;
+        if (statvfs(mount->path, &vfs) == -1) {
+            mount->error = errno;
+            continue;
+        }
+        mount->free_bytes = (uint64_t)vfs.f_bavail * vfs.f_frsize;
+        mount->total_bytes = (uint64_t)vfs.f_blocks * vfs.f_frsize;
+    }
+
+    double elapsed_ms = pressure_elapsed_ms(&previous.sampled, &now);
+    globus_bool_t have_baseline = (previous.magic == OSG_PRESSURE_MAGIC) &&
+        (elapsed_ms > 0) && (elapsed_ms <= 2000.0 * osg_pressure_interval);
+
+    sample->device_count = osg_pressure_device_count;
+    for (idx = 0; idx < osg_pressure_device_count; idx++) {
+        memset(&sample->devices[idx], '\0', sizeof(sample->devices[idx]));
+        strncpy(sample->devices[idx].name, osg_pressure_devices[idx], 31);
+        sample->devices[idx].utilization = -1;
+    }
+    FILE *fp = fopen("/proc/diskstats", "r");
+    char line[512];
+    while (fp && fgets(line, sizeof(line), fp)) {
+        unsigned int major, minor;
+        char name[32];
+        unsigned long long stats[11];
+        if (14 != sscanf(line, "%u %u %31s %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+                         &major, &minor, name, &stats[0], &stats[1], &stats[2], &stats[3], &stats[4],
+                         &stats[5], &stats[6], &stats[7], &stats[8], &stats[9], &stats[10]))
+        {
+            continue;
+        }
+        for (idx = 0; idx < osg_pressure_device_count; idx++) {
+            osg_pressure_device_t *device = &sample->devices[idx];
+            if (strcmp(device->name, name)) {continue;}
+            device->found = 1;
+            device->in_flight = stats[8];
+            device->io_ticks = stats[9];
+            if (have_baseline && (idx < (int)previous.device_count) &&
+                previous.devices[idx].found && !strcmp(previous.devices[idx].name, name) &&
+                (device->io_ticks >= previous.devices[idx].io_ticks))
+            {
+                device->utilization = 100.0 * (device->io_ticks - previous.devices[idx].io_ticks) / elapsed_ms;
+            }
+        }
+    }
+    if (fp) {fclose(fp);}
+    sample->measuring = 0;
+    for (idx = 0; idx < osg_pressure_device_count; idx++) {
+        if (sample->devices[idx].found && (sample->devices[idx].utilization < 0)) {sample->measuring = 1;}
+    }
+    sample->sampled = now;
+}
+
+
+// Does the shared sample need refreshing?
+static globus_bool_t
+pressure_stale(const osg_pressure_sample_t *shared)
+{
+    if (shared->magic != OSG_PRESSURE_MAGIC) {return GLOBUS_TRUE;}
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double age_ms = pressure_elapsed_ms(&shared->sampled, &now);
+    return age_ms >= (shared->measuring ? OSG_PRESSURE_MIN_WINDOW_MS : 1000.0 * osg_pressure_interval);
+}
+
+
+// Samples taken by this process when the shared file cannot be used.
+static osg_pressure_sample_t osg_pressure_private;
+
+
+/*
+ * Copy the current shared sample into `sample`, refreshing it first if it
+ * is stale.  Falls back to a sample private to this process if the shared
+ * file cannot be opened or is not owned by this account.
+ */
+static globus_bool_t
+pressure_get_sample(osg_pressure_sample_t *sample)
+{
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s.%u", osg_pressure_file, (unsigned)geteuid());
+    int fd = open(filename, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+    struct stat st;
+    if (fd == -1) {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_DUMP, "Unable to open storage pressure file %s: %s\n", filename, strerror(errno));
+    } else if ((fstat(fd, &st) == -1) || !S_ISREG(st.st_mode) || (st.st_uid != geteuid()) ||
+               (fchmod(fd, 0644) == -1) ||
+               ((st.st_size < (off_t)sizeof(osg_pressure_sample_t)) &&
+                (ftruncate(fd, sizeof(osg_pressure_sample_t)) == -1)))
+    {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Ignoring storage pressure file %s: not a regular file owned by uid %u.\n",
+                               filename, (unsigned)geteuid());
+        close(fd);
+        fd = -1;
+    }
+    osg_pressure_sample_t *shared = (fd == -1) ? MAP_FAILED : (osg_pressure_sample_t *)mmap(NULL,
+        sizeof(osg_pressure_sample_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shared == MAP_FAILED) {
+        if (fd != -1) {close(fd);}
+        if (pressure_stale(&osg_pressure_private)) {
+            pressure_sample(&osg_pressure_private);
+            osg_pressure_private.magic = OSG_PRESSURE_MAGIC;
+        }
+        *sample = osg_pressure_private;
+        return GLOBUS_TRUE;
+    }
+
+    // Only one process refreshes; the rest use the sample they find.
+    if (pressure_stale(shared) && !flock(fd, LOCK_EX | LOCK_NB)) {
+        if (pressure_stale(shared)) {
+            osg_pressure_sample_t fresh = *shared;
+            pressure_sample(&fresh);
+            __sync_fetch_and_add(&shared->seq, 1);
+            __sync_synchronize();
+            memcpy((char *)shared + offsetof(osg_pressure_sample_t, sampled),
+                   (char *)&fresh + offsetof(osg_pressure_sample_t, sampled),
+                   sizeof(osg_pressure_sample_t) - offsetof(osg_pressure_sample_t, sampled));
+            shared->magic = OSG_PRESSURE_MAGIC;
+            __sync_synchronize();
+            __sync_fetch_and_add(&shared->seq, 1);
+        }
+        flock(fd, LOCK_UN);
+    }
+    close(fd);
+
+    globus_bool_t valid = GLOBUS_FALSE;
+    int tries;
+    for (tries = 0; tries < 100; tries++) {
+        uint32_t seq = shared->seq;
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        __sync_synchronize();
+        memcpy(sample, shared, sizeof(osg_pressure_sample_t));
+        __sync_synchronize();
+        if (seq == shared->seq) {
+            valid = sample->magic == OSG_PRESSURE_MAGIC;
+            break;
+        }
+    }
+    munmap(shared, sizeof(osg_pressure_sample_t));
+    return valid;
+}
+
+
+/*
+ * Returns GLOBUS_TRUE and describes the problem in `reason` if an upload to
+ * `pathname` should not proceed right now.  Sets `measuring` if the
+ * utilization of a relevant device is not known yet.
+ */
+static globus_bool_t
+pressure_exceeded(const char *pathname, char *reason, size_t reason_len, globus_bool_t *measuring)
+{
+    *measuring = GLOBUS_FALSE;
+    osg_pressure_sample_t sample;
+    if (!pressure_get_sample(&sample)) {return GLOBUS_FALSE;}
+
+    int idx;
+    for (idx = 0; idx < osg_pressure_mount_count && idx < (int)sample.mount_count; idx++) {
+        osg_pressure_min_free_t *limit = &osg_pressure_min_free[idx];
+        osg_pressure_mount_t *mount = &sample.mounts[idx];
+        if (mount->error || strcmp(mount->path, limit->path) ||
+            !osg_path_has_prefix(pathname, limit->path))
+        {
+            continue;
+        }
+        uint64_t min_free = limit->min_percent ? mount->total_bytes / 100 * limit->min_percent : (uint64_t)limit->min_bytes;
+        if (mount->free_bytes < min_free) {
+            snprintf(reason, reason_len, "%s has %llu bytes free (minimum %llu)", mount->path,
+                     (unsigned long long)mount->free_bytes, (unsigned long long)min_free);
+            return GLOBUS_TRUE;
+        }
+    }
+    for (idx = 0; idx < (int)sample.device_count; idx++) {
+        osg_pressure_device_t *device = &sample.devices[idx];
+        if (!device->found || (idx >= osg_pressure_device_count) ||
+            strcmp(device->name, osg_pressure_devices[idx]) ||
+            (osg_pressure_device_paths[idx][0] && !osg_path_has_prefix(pathname, osg_pressure_device_paths[idx])))
+        {
+            continue;
+        }
+        if ((osg_pressure_max_util >= 0) && (device->utilization < 0)) {*measuring = GLOBUS_TRUE;}
+        if ((osg_pressure_max_util >= 0) && (device->utilization > osg_pressure_max_util)) {
+            snprintf(reason, reason_len, "device %s is %.0f%% busy (maximum %d%%)", device->name,
+                     device->utilization, osg_pressure_max_util);
+            return GLOBUS_TRUE;
+        }
+        if ((osg_pressure_max_queue >= 0) && (device->in_flight > (uint64_t)osg_pressure_max_queue)) {
+            snprintf(reason, reason_len, "device %s has %llu requests in flight (maximum %d)", device->name,
+                     (unsigned long long)device->in_flight, osg_pressure_max_queue);
+            return GLOBUS_TRUE;
+        }
+    }
+    return GLOBUS_FALSE;
+}
+
+
+static void
+pressure_retry(void *user_arg);
+
+
+/*
+ * Check the storage for the upload `waiter` describes.  Calls back when it
+ * may proceed or has waited too long; otherwise checks again later.
+ */
+static void
+pressure_poll(osg_pressure_waiter_t *waiter)
+{
+    GlobusGFSName(pressure_poll);
+    globus_result_t result = GLOBUS_SUCCESS;
+    const char *pathname = waiter->transfer_info->pathname;
+
+    char reason[512];
+    globus_bool_t measuring;
+    globus_bool_t exceeded = pressure_exceeded(pathname, reason, sizeof(reason), &measuring);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double waited_ms = pressure_elapsed_ms(&waiter->start, &now);
+
+    globus_reltime_t delay;
+    if (exceeded && (waited_ms < 1000.0 * osg_pressure_wait)) {
+        GlobusTimeReltimeSet(delay, 1, 0);
+    } else if (measuring && !exceeded && (waited_ms < 2 * OSG_PRESSURE_MIN_WINDOW_MS)) {
+        GlobusTimeReltimeSet(delay, 0, OSG_PRESSURE_MIN_WINDOW_MS * 1000);
+    } else {
+        if (exceeded) {
+            globus_gfs_log_message(GLOBUS_GFS_LOG_INFO, "Rejecting upload of %s for %s: %s.\n", pathname,
+                                   osg_session_username[0] ? osg_session_username : "UNKNOWN", reason);
+            GlobusGFSErrorGenericStr(result, ("Storage is under pressure (%s); try again later", reason));
+        }
+        waiter->callback(waiter->op, waiter->transfer_info, waiter->user_arg, result);
+        globus_free(waiter);
+        return;
+    }
+
+    result = globus_callback_register_oneshot(NULL, &delay, pressure_retry, waiter);
+    if (result != GLOBUS_SUCCESS) {
+        waiter->callback(waiter->op, waiter->transfer_info, waiter->user_arg, result);
+        globus_free(waiter);
+    }
+}
+
+
+static void
+pressure_retry(void *user_arg)
+{
+    pressure_poll((osg_pressure_waiter_t *)user_arg);
+}
+
+
+/*************************************************************************
+ * osg_pressure_check
+ * ------------------
+ * Admission check for an upload.  While the storage is over a threshold,
+ * wait up to OSG_STORAGE_PRESSURE_WAIT seconds for it to recover, then
+ * call `callback` with the outcome; if it does not recover, the upload is
+ * failed before any data is sent.  The callback may run before this returns.
+ *************************************************************************/
+void
+osg_pressure_check(
+    globus_gfs_operation_t              op,
+    globus_gfs_transfer_info_t *        transfer_info,
+    void *                              user_arg,
+    osg_pressure_callback_t             callback)
+{
+    GlobusGFSName(osg_pressure_check);
+
+    if (!osg_pressure_configured || !transfer_info->pathname) {
+        callback(op, transfer_info, user_arg, GLOBUS_SUCCESS);
+        return;
+    }
+
+    osg_pressure_waiter_t *waiter = (osg_pressure_waiter_t *)globus_calloc(1, sizeof(osg_pressure_waiter_t));
+    if (!waiter) {
+        callback(op, transfer_info, user_arg, GlobusGFSErrorMemory("pressure waiter"));
+        return;
+    }
+    waiter->op = op;
+    waiter->transfer_info = transfer_info;
+    waiter->user_arg = user_arg;
+    waiter->callback = callback;
+    clock_gettime(CLOCK_MONOTONIC, &waiter->start);
+    pressure_poll(waiter);
+}
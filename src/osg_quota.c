@@ -0,0 +1,309 @@
+
+#include "osg_extensions.h"
+
+#include <libgen.h>
+#include <string.h>
+
+/*************************************************************************
+ * Quota pre-check
+ * ---------------
+ * When OSG_QUOTA_CHECK is set, an upload whose size was announced with ALLO
+ * is compared against the free space reported by the site usage script
+ * (the provider behind SITE USAGE) for the directory being written, using
+ * token OSG_QUOTA_CHECK_TOKEN (default `default`).  Uploads which cannot
+ * fit are failed before any data moves.
+ *
+ * Script results are cached per process for OSG_QUOTA_CACHE_TTL seconds;
+ * when an upload finishes, the bytes it actually wrote come off the cached
+ * free space (or, if the upload path could not tell, the entry is dropped).  So that concurrent
+ * uploads do not all pass against the same free space, each admitted upload
+ * reserves its size in a shared ledger and the check subtracts everyone
+ * else's reservations.  Reservations are keyed by the token and the quota
+ * total the script reports, so that uploads into different directories of
+ * the same quota see each other.  As with the connection limits, a
+ * reservation is a byte-range lock on a slot of the ledger: it disappears
+ * automatically if the server process exits.
+ *
+ * The ledger must be writable by every account that runs transfers (the
+ * locks need a writable descriptor).  It is created 0666; an existing file
+ * keeps its permissions, so a site can pre-create it for a shared group.
+ *************************************************************************/
+
+#define OSG_QUOTA_DEFAULT_TTL 60
+#define OSG_QUOTA_CACHE_ENTRIES 16
+#define OSG_QUOTA_LEDGER_SLOTS 1024
+#define OSG_QUOTA_DEFAULT_LEDGER "/dev/shm/gridftp-osg-quota-reservations"
+
+typedef struct {
+    char key[1300];
+    time_t queried;
+    long long usage;
+    long long free;
+    long long total;
+} osg_quota_cache_entry_t;
+
+typedef struct {
+    uint64_t key_hash;
+    int64_t bytes;
+} osg_quota_slot_t;
+
+static osg_quota_cache_entry_t osg_quota_cache[OSG_QUOTA_CACHE_ENTRIES];
+
+// This process's outstanding reservation, if any.
+static int osg_quota_ledger_fd = -1;
+static int osg_quota_slot = -1;
+
+// The token and quota total of this process's admitted upload, if any,
+// and the bytes it wrote (-1 if unknown).
+static char osg_quota_admitted_token[256];
+static long long osg_quota_admitted_total;
+static globus_bool_t osg_quota_admitted = GLOBUS_FALSE;
+static globus_off_t osg_quota_written = -1;
+
+
+static uint64_t
+quota_hash(const char *key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+static globus_result_t
+quota_lookup(const char *token, const char *directory, const char *key, long long *usage, long long *free_bytes, long long *total)
+{
+    int ttl = OSG_QUOTA_DEFAULT_TTL;
+    const char *ttl_char = getenv("OSG_QUOTA_CACHE_TTL");
+    if (ttl_char) {ttl = atoi(ttl_char);}
+
+    time_t now = time(NULL);
+    osg_quota_cache_entry_t *oldest = &osg_quota_cache[0];
+    int idx;
+    for (idx = 0; idx < OSG_QUOTA_CACHE_ENTRIES; idx++) {
+        osg_quota_cache_entry_t *entry = &osg_quota_cache[idx];
+        if (entry->queried && !strcmp(entry->key, key) && (now - entry->queried < ttl)) {
+            *usage = entry->usage;
+            *free_bytes = entry->free;
+            *total = entry->total;
+            return GLOBUS_SUCCESS;
+        }
+        if (entry->queried < oldest->queried) {oldest = entry;}
+    }
+
+    const char *failure_response;
+    globus_result_t result = osg_site_usage_query(token, directory, usage, free_bytes, total, &failure_response);
+    if (result != GLOBUS_SUCCESS) {return result;}
+
+    strncpy(oldest->key, key, sizeof(oldest->key) - 1);
+    oldest->key[sizeof(oldest->key) - 1] = '\0';
+    oldest->queried = now;
+    oldest->usage = *usage;
+    oldest->free = *free_bytes;
+    oldest->total = *total;
+    return GLOBUS_SUCCESS;
+}
+
+
+static void
+slot_lock_init(struct flock *lock, short type, int slot)
+{
+    memset(lock, '\0', sizeof(*lock));
+    lock->l_type = type;
+    lock->l_whence = SEEK_SET;
+    lock->l_start = slot * sizeof(osg_quota_slot_t);
+    lock->l_len = sizeof(osg_quota_slot_t);
+}
+
+
+/*
+ * Sum the live reservations of other processes against `key_hash`.
+ */
+static int64_t
+quota_reserved(int fd, uint64_t key_hash)
+{
+    int64_t reserved = 0;
+    int slot;
+    for (slot = 0; slot < OSG_QUOTA_LEDGER_SLOTS; slot++) {
+        osg_quota_slot_t entry;
+        if (pread(fd, &entry, sizeof(entry), slot * sizeof(entry)) != sizeof(entry)) {break;}
+        if ((entry.key_hash != key_hash) || (entry.bytes <= 0) || (slot == osg_quota_slot)) {continue;}
+        struct flock lock;
+        slot_lock_init(&lock, F_WRLCK, slot);
+        if ((fcntl(fd, F_GETLK, &lock) == 0) && (lock.l_type != F_UNLCK)) {
+            reserved += entry.bytes;
+        }
+    }
+    return reserved;
+}
+
+
+/*
+ * Record a reservation of `bytes` in the first free slot of the ledger.
+ */
+static void
+quota_reserve(int fd, uint64_t key_hash, int64_t bytes)
+{
+    int slot;
+    for (slot = 0; slot < OSG_QUOTA_LEDGER_SLOTS; slot++) {
+        struct flock lock;
+        slot_lock_init(&lock, F_WRLCK, slot);
+        if (fcntl(fd, F_SETLK, &lock) == -1) {continue;}
+        osg_quota_slot_t entry;
+        entry.key_hash = key_hash;
+        entry.bytes = bytes;
+        if (pwrite(fd, &entry, sizeof(entry), slot * sizeof(entry)) != sizeof(entry)) {
+            slot_lock_init(&lock, F_UNLCK, slot);
+            fcntl(fd, F_SETLK, &lock);
+            continue;
+        }
+        osg_quota_slot = slot;
+        return;
+    }
+    globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Quota reservation ledger is full; upload not reserved.\n");
+}
+
+
+/*
+ * Account for the finished upload in the cached free space of every
+ * directory in its quota: its data is now on disk, and its reservation no
+ * longer covers it.
+ */
+static void
+quota_cache_consume(void)
+{
+    if (!osg_quota_admitted) {return;}
+    size_t token_len = strlen(osg_quota_admitted_token);
+    int idx;
+    for (idx = 0; idx < OSG_QUOTA_CACHE_ENTRIES; idx++) {
+        osg_quota_cache_entry_t *entry = &osg_quota_cache[idx];
+        if (!entry->queried || (entry->total != osg_quota_admitted_total) ||
+            strncmp(entry->key, osg_quota_admitted_token, token_len) || (entry->key[token_len] != ' '))
+        {
+            continue;
+        }
+        if (osg_quota_written >= 0) {
+            entry->free -= osg_quota_written;
+        } else {
+            entry->queried = 0;
+        }
+    }
+    osg_quota_admitted = GLOBUS_FALSE;
+    osg_quota_written = -1;
+}
+
+
+void
+osg_quota_finished(globus_off_t written)
+{
+    osg_quota_written = written;
+    osg_quota_release();
+}
+
+
+void
+osg_quota_release(void)
+{
+    quota_cache_consume();
+    if (osg_quota_slot < 0) {return;}
+
+    osg_quota_slot_t entry;
+    memset(&entry, '\0', sizeof(entry));
+    pwrite(osg_quota_ledger_fd, &entry, sizeof(entry), osg_quota_slot * sizeof(entry));
+    struct flock lock;
+    slot_lock_init(&lock, F_UNLCK, osg_quota_slot);
+    fcntl(osg_quota_ledger_fd, F_SETLK, &lock);
+    osg_quota_slot = -1;
+}
+
+
+/*************************************************************************
+ * osg_quota_check
+ * ---------------
+ * Admit or reject an upload of `size` bytes (-1 if unknown) to `pathname`,
+ * reserving the size if admitted.  The reservation is held until
+ * osg_quota_release(), the next upload, or the end of the process.
+ *************************************************************************/
+globus_result_t
+osg_quota_check(const char *username, const char *pathname, globus_off_t size)
+{
+    GlobusGFSName(osg_quota_check);
+    globus_result_t result = GLOBUS_SUCCESS;
+
+    osg_quota_release();
+    if (!getenv("OSG_QUOTA_CHECK") || !pathname) {return result;}
+
+    const char *token = getenv("OSG_QUOTA_CHECK_TOKEN");
+    token = token ? token : "default";
+    char directory[1024];
+    strncpy(directory, pathname, 1023);
+    directory[1023] = '\0';
+    dirname(directory);
+
+    char key[1300];
+    snprintf(key, sizeof(key), "%s %s", token, directory);
+    key[sizeof(key)-1] = '\0';
+
+    long long usage, free_bytes, total;
+    result = quota_lookup(token, directory, key, &usage, &free_bytes, &total);
+    if (result != GLOBUS_SUCCESS) {
+        // Without usage data there is nothing to check against; let the
+        // filesystem enforce its own limits as before.
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Unable to query usage for %s; skipping quota check.\n", directory);
+        return GLOBUS_SUCCESS;
+    }
+
+    if (osg_quota_ledger_fd == -1) {
+        const char *ledger = getenv("OSG_QUOTA_LEDGER_FILE");
+        ledger = ledger ? ledger : OSG_QUOTA_DEFAULT_LEDGER;
+        osg_quota_ledger_fd = open(ledger, O_RDWR | O_CREAT | O_EXCL, 0666);
+        if (osg_quota_ledger_fd != -1) {
+            fchmod(osg_quota_ledger_fd, 0666);
+        } else if (errno == EEXIST) {
+            osg_quota_ledger_fd = open(ledger, O_RDWR);
+        }
+        if (osg_quota_ledger_fd != -1) {
+            posix_fallocate(osg_quota_ledger_fd, 0, OSG_QUOTA_LEDGER_SLOTS * sizeof(osg_quota_slot_t));
+        } else {
+            globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Unable to open quota ledger %s: %s\n", ledger, strerror(errno));
+        }
+    }
+
+    // Serialize check-and-reserve across processes with a lock just past
+    // the slots; otherwise two uploads could both fit into the same space.
+    struct flock ledger_lock;
+    slot_lock_init(&ledger_lock, F_WRLCK, OSG_QUOTA_LEDGER_SLOTS);
+    globus_bool_t ledger_locked = (osg_quota_ledger_fd != -1) &&
+                                  (fcntl(osg_quota_ledger_fd, F_SETLKW, &ledger_lock) == 0);
+
+    char ledger_key[300];
+    snprintf(ledger_key, sizeof(ledger_key), "%s %lld", token, total);
+    ledger_key[sizeof(ledger_key)-1] = '\0';
+    uint64_t key_hash = quota_hash(ledger_key);
+    int64_t reserved = ledger_locked ? quota_reserved(osg_quota_ledger_fd, key_hash) : 0;
+    long long available = free_bytes - reserved;
+    globus_bool_t fits = (size > 0) ? (size <= available) : (available > 0);
+    if (fits && (size > 0) && ledger_locked) {
+        quota_reserve(osg_quota_ledger_fd, key_hash, size);
+    }
+    if (fits) {
+        strncpy(osg_quota_admitted_token, token, sizeof(osg_quota_admitted_token) - 1);
+        osg_quota_admitted_token[sizeof(osg_quota_admitted_token) - 1] = '\0';
+        osg_quota_admitted_total = total;
+        osg_quota_admitted = GLOBUS_TRUE;
+    }
+    if (ledger_locked) {
+        slot_lock_init(&ledger_lock, F_UNLCK, OSG_QUOTA_LEDGER_SLOTS);
+        fcntl(osg_quota_ledger_fd, F_SETLK, &ledger_lock);
+    }
+
+    if (!fits) {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_INFO, "Rejecting upload of %s (%lld bytes) for %s: %lld bytes free, %lld reserved by other uploads.\n",
+            pathname, (long long)size, username ? username : "UNKNOWN", free_bytes, (long long)reserved);
+        GlobusGFSErrorGenericStr(result, ("Insufficient space for upload: %lld bytes requested, %lld bytes available", (long long)size, available > 0 ? available : 0));
+    }
+    return result;
+}
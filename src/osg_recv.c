@@ -0,0 +1,547 @@
+
+#include "osg_extensions.h"
+
+#include <fcntl.h>
+#include <string.h>
+
+/*************************************************************************
+ * osg_recv
+ * --------
+ * Upload path implemented in the OSG layer so uploaded data passes through
+ * our hands on its way to disk.  It is used only when layered on top of the
+ * 'file' DSI and when one of the features needing it is configured;
+ * otherwise (and for ESTO-style module transfers, and for restarted,
+ * partial, or appending uploads, whose offsets the server adjusts) the
+ * underlying DSI's recv function handles the transfer unchanged.  New files
+ * get the server's `perms` setting (default 0644) less the umask, as the
+ * file DSI creates them.
+ *
+ * Every upload, whichever path handles it, first passes the storage
+ * back-pressure check (osg_pressure.c) and the quota pre-check
+ * (osg_quota.c).
+ *
+ * Per-path write policies (OSG_WRITE_POLICY) control how blocks reach the
+ * disk:
+ *  - prealloc: reserve the announced (ALLO) size up front with fallocate()
+ *    so the file is laid out contiguously.
+ *  - gather=SIZE: collect blocks from the parallel streams into a window of
+ *    SIZE bytes and write contiguous runs with one pwrite() each.
+ *  - writebehind=SIZE: every SIZE bytes of contiguous data written, start
+ *    writeback of it with sync_file_range() and drop whatever of the
+ *    previous chunk is already on disk from the page cache, so large uploads
+ *    do not evict everything else.  Data callbacks never wait for the disk:
+ *    the one wait, for the rest of the file, happens when it is closed.
+ *
+ * Uploads announced (by ALLO) as no larger than OSG_SMALL_FILE_THRESHOLD
+ * are collected in one pooled buffer of that size and written with a
+ * single pwrite() at the end.  If the data outgrows the buffer, what has
+ * arrived so far is written out and the rest of the upload continues with
+ * the policies above.  Uploads of unknown size do not take this path, so
+ * large ones are not copied through the buffer first.
+ *************************************************************************/
+
+typedef struct {
+    // Start writeback of [start_offset, start_end) ...
+    globus_off_t start_offset;
+    globus_off_t start_end;
+    // ... and drop the written-back pages of [drop_offset, drop_end) from
+    // the page cache.
+    globus_off_t drop_offset;
+    globus_off_t drop_end;
+} osg_recv_wb_job_t;
+
+typedef struct osg_recv_monitor_s {
+    globus_mutex_t mutex;
+    globus_gfs_operation_t op;
+    char *pathname;
+    int fd;
+    globus_size_t block_size;
+    int outstanding;
+    globus_bool_t eof;
+    globus_result_t result;
+    // Bytes written to the file, for the quota cache.
+    globus_off_t bytes_written;
+    osg_checksum_t *cksm;
+    osg_write_policy_t policy;
+    // Gather window: [gather_offset, gather_offset + gather_size).  For a
+    // small file, the window is the pooled buffer covering [0, gather_size).
+    globus_byte_t *gather_buffer;
+    globus_off_t gather_offset;
+    globus_off_t gather_size;
+    globus_bool_t small_file;
+    globus_range_list_t gather_ranges;
+    // Write-behind: everything below wb_written has been written (blocks
+    // past it, from parallel streams, wait in wb_ranges); data below
+    // wb_started has had writeback started; data below wb_dropped has
+    // been offered for dropping from the page cache.
+    globus_range_list_t wb_ranges;
+    globus_off_t wb_written;
+    globus_off_t wb_started;
+    globus_off_t wb_dropped;
+    // Write-behind work decided under the lock, done outside it.
+    osg_recv_wb_job_t wb_job;
+} osg_recv_monitor_t;
+
+
+static void
+osg_recv_read_cb(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result,
+    globus_byte_t *                     buffer,
+    globus_size_t                       nbytes,
+    globus_off_t                        offset,
+    globus_bool_t                       eof,
+    void *                              user_arg);
+
+
+static void
+osg_recv_monitor_destroy(osg_recv_monitor_t *monitor)
+{
+    if (monitor->cksm) {osg_checksum_destroy(monitor->cksm);}
+    if (monitor->gather_buffer) {
+        if (monitor->small_file) {osg_buffer_put(monitor->gather_buffer, monitor->gather_size);}
+        else {globus_free(monitor->gather_buffer);}
+    }
+    if (monitor->gather_ranges) {globus_range_list_destroy(monitor->gather_ranges);}
+    if (monitor->wb_ranges) {globus_range_list_destroy(monitor->wb_ranges);}
+    if (monitor->fd != -1) {close(monitor->fd);}
+    globus_free(monitor->pathname);
+    globus_mutex_destroy(&monitor->mutex);
+    globus_free(monitor);
+}
+
+
+/*
+ * Note that [offset, offset + nbytes) has been written.  Once the
+ * contiguous written prefix has grown by writebehind_size since writeback
+ * was last started, queue a job to start writeback of the new data and to
+ * drop the previous chunk from the page cache.  Must be called with the
+ * monitor locked; the job is run by osg_recv_write_behind() after
+ * unlocking, since submitting writeback may still block on a full queue.
+ */
+static void
+osg_recv_note_written(osg_recv_monitor_t *monitor, globus_off_t offset, globus_size_t nbytes)
+{
+    globus_range_list_insert(monitor->wb_ranges, offset, nbytes);
+    while (globus_range_list_size(monitor->wb_ranges)) {
+        globus_off_t first_offset, first_length;
+        globus_range_list_at(monitor->wb_ranges, 0, &first_offset, &first_length);
+        if (first_offset > monitor->wb_written) {break;}
+        globus_range_list_remove(monitor->wb_ranges, first_offset, first_length);
+        if (first_offset + first_length > monitor->wb_written) {
+            monitor->wb_written = first_offset + first_length;
+        }
+    }
+
+    if ((monitor->wb_written - monitor->wb_started) < monitor->policy.writebehind_size) {return;}
+
+    osg_recv_wb_job_t *job = &monitor->wb_job;
+    if (job->start_end == job->start_offset) {job->start_offset = monitor->wb_started;}
+    job->start_end = monitor->wb_written;
+    if (monitor->wb_started > monitor->wb_dropped) {
+        if (job->drop_end == job->drop_offset) {job->drop_offset = monitor->wb_dropped;}
+        job->drop_end = monitor->wb_started;
+    }
+    monitor->wb_dropped = monitor->wb_started;
+    monitor->wb_started = monitor->wb_written;
+}
+
+
+/*
+ * Take the pending write-behind job; must be called with the monitor locked.
+ */
+static osg_recv_wb_job_t
+osg_recv_take_job(osg_recv_monitor_t *monitor)
+{
+    osg_recv_wb_job_t job = monitor->wb_job;
+    memset(&monitor->wb_job, '\0', sizeof(monitor->wb_job));
+    return job;
+}
+
+
+static void
+osg_recv_write_behind(int fd, const osg_recv_wb_job_t *job)
+{
+    if (job->start_end > job->start_offset) {
+        sync_file_range(fd, job->start_offset, job->start_end - job->start_offset, SYNC_FILE_RANGE_WRITE);
+    }
+    // Pages still under writeback stay cached; the final flush drops them.
+    if (job->drop_end > job->drop_offset) {
+        posix_fadvise(fd, job->drop_offset, job->drop_end - job->drop_offset, POSIX_FADV_DONTNEED);
+    }
+}
+
+
+static globus_result_t
+osg_recv_write(osg_recv_monitor_t *monitor, const globus_byte_t *buffer, globus_size_t nbytes, globus_off_t offset)
+{
+    GlobusGFSName(osg_recv_write);
+
+    globus_size_t written = 0;
+    while (written < nbytes) {
+        ssize_t retval = pwrite(monitor->fd, buffer + written, nbytes - written, offset + written);
+        if (retval == -1) {
+            if (errno == EINTR) {continue;}
+            return GlobusGFSErrorSystemError("pwrite", errno);
+        }
+        written += retval;
+    }
+    monitor->bytes_written += nbytes;
+    globus_gridftp_server_update_bytes_written(monitor->op, offset, nbytes);
+    if (monitor->cksm) {
+        osg_checksum_update(monitor->cksm, monitor->fd, buffer, offset, nbytes);
+    }
+    if (monitor->wb_ranges) {osg_recv_note_written(monitor, offset, nbytes);}
+    return GLOBUS_SUCCESS;
+}
+
+
+/*
+ * Write out each contiguous run held in the gather window and empty it.
+ */
+static globus_result_t
+osg_recv_flush(osg_recv_monitor_t *monitor)
+{
+    globus_result_t result = GLOBUS_SUCCESS;
+    while (globus_range_list_size(monitor->gather_ranges)) {
+        globus_off_t offset, length;
+        globus_range_list_at(monitor->gather_ranges, 0, &offset, &length);
+        globus_range_list_remove(monitor->gather_ranges, offset, length);
+        if (result == GLOBUS_SUCCESS) {
+            result = osg_recv_write(monitor,
+                                    monitor->gather_buffer + (offset - monitor->gather_offset),
+                                    length,
+                                    offset);
+        }
+    }
+    return result;
+}
+
+
+/*
+ * A small-file upload turned out larger than its buffer: write out what
+ * has been collected and carry on as a normal upload.
+ */
+static globus_result_t
+osg_recv_spill(osg_recv_monitor_t *monitor)
+{
+    globus_result_t result = osg_recv_flush(monitor);
+    osg_buffer_put(monitor->gather_buffer, monitor->gather_size);
+    monitor->gather_buffer = NULL;
+    monitor->small_file = GLOBUS_FALSE;
+    monitor->gather_offset = 0;
+    monitor->gather_size = monitor->policy.gather_size;
+    if (monitor->gather_size > (globus_off_t)monitor->block_size) {
+        monitor->gather_buffer = (globus_byte_t *)globus_malloc(monitor->gather_size);
+    }
+    if (!monitor->gather_buffer) {
+        globus_range_list_destroy(monitor->gather_ranges);
+        monitor->gather_ranges = NULL;
+    }
+    return result;
+}
+
+
+/*
+ * Handle one received block, either through the gather window or by
+ * writing it directly.
+ */
+static globus_result_t
+osg_recv_store(osg_recv_monitor_t *monitor, const globus_byte_t *buffer, globus_size_t nbytes, globus_off_t offset)
+{
+    if (monitor->small_file && (offset + (globus_off_t)nbytes > monitor->gather_size)) {
+        globus_result_t result = osg_recv_spill(monitor);
+        if (result != GLOBUS_SUCCESS) {return result;}
+    }
+    if (!monitor->gather_buffer) {
+        return osg_recv_write(monitor, buffer, nbytes, offset);
+    }
+
+    globus_off_t window = monitor->gather_size;
+    if ((offset < monitor->gather_offset) || (offset + (globus_off_t)nbytes > monitor->gather_offset + window)) {
+        globus_result_t result = osg_recv_flush(monitor);
+        if (result != GLOBUS_SUCCESS) {return result;}
+        if ((globus_off_t)nbytes >= window) {
+            return osg_recv_write(monitor, buffer, nbytes, offset);
+        }
+        monitor->gather_offset = offset;
+    }
+    memcpy(monitor->gather_buffer + (offset - monitor->gather_offset), buffer, nbytes);
+    globus_range_list_insert(monitor->gather_ranges, offset, nbytes);
+
+    // A completely filled window need not wait for the next block.
+    globus_off_t first_offset, first_length;
+    globus_range_list_at(monitor->gather_ranges, 0, &first_offset, &first_length);
+    if ((first_offset == monitor->gather_offset) && (first_length == window)) {
+        return osg_recv_flush(monitor);
+    }
+    return GLOBUS_SUCCESS;
+}
+
+
+/*
+ * Register a read into `buffer`; on failure the buffer is freed.  Must be
+ * called with the monitor locked.
+ */
+static void
+osg_recv_register(osg_recv_monitor_t *monitor, globus_byte_t *buffer)
+{
+    globus_result_t result = globus_gridftp_server_register_read(monitor->op,
+                                 buffer,
+                                 monitor->block_size,
+                                 osg_recv_read_cb,
+                                 monitor);
+    if (result != GLOBUS_SUCCESS) {
+        globus_free(buffer);
+        if (monitor->result == GLOBUS_SUCCESS) {monitor->result = result;}
+        return;
+    }
+    monitor->outstanding++;
+}
+
+
+static void
+osg_recv_read_cb(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result,
+    globus_byte_t *                     buffer,
+    globus_size_t                       nbytes,
+    globus_off_t                        offset,
+    globus_bool_t                       eof,
+    void *                              user_arg)
+{
+    GlobusGFSName(osg_recv_read_cb);
+    osg_recv_monitor_t *monitor = (osg_recv_monitor_t *)user_arg;
+    globus_bool_t finished = GLOBUS_FALSE;
+
+    osg_recv_wb_job_t job;
+    globus_mutex_lock(&monitor->mutex);
+    {
+        if ((result != GLOBUS_SUCCESS) && (monitor->result == GLOBUS_SUCCESS)) {
+            monitor->result = result;
+        }
+        if ((monitor->result == GLOBUS_SUCCESS) && nbytes) {
+            monitor->result = osg_recv_store(monitor, buffer, nbytes, offset);
+        }
+        job = osg_recv_take_job(monitor);
+    }
+    globus_mutex_unlock(&monitor->mutex);
+
+    // Still counted as outstanding, so the file cannot be closed under us.
+    osg_recv_write_behind(monitor->fd, &job);
+
+    globus_mutex_lock(&monitor->mutex);
+    {
+        monitor->outstanding--;
+        if (eof) {monitor->eof = GLOBUS_TRUE;}
+
+        if (!monitor->eof && (monitor->result == GLOBUS_SUCCESS)) {
+            osg_recv_register(monitor, buffer);
+        } else {
+            globus_free(buffer);
+        }
+        finished = monitor->outstanding == 0;
+    }
+    globus_mutex_unlock(&monitor->mutex);
+
+    if (!finished) {return;}
+
+    result = monitor->result;
+    if ((result == GLOBUS_SUCCESS) && monitor->gather_buffer) {
+        result = osg_recv_flush(monitor);
+    }
+    // The only wait on the disk: let writeback of the whole file finish
+    // so the pages left behind by the callbacks can be dropped.
+    if (monitor->wb_ranges) {
+        sync_file_range(monitor->fd, 0, 0,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(monitor->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    if ((result == GLOBUS_SUCCESS) && monitor->cksm) {
+        osg_checksum_finish(monitor->cksm, monitor->fd, monitor->pathname);
+    }
+    if ((close(monitor->fd) == -1) && (result == GLOBUS_SUCCESS)) {
+        result = GlobusGFSErrorSystemError("close", errno);
+    }
+    monitor->fd = -1;
+    osg_listing_cache_invalidate(monitor->pathname);
+    globus_off_t bytes_written = monitor->bytes_written;
+    osg_recv_monitor_destroy(monitor);
+    osg_quota_finished(bytes_written);
+    globus_gridftp_server_finished_transfer(op, result);
+}
+
+
+/*
+ * Does the upload start anywhere but the beginning of a truncated file?
+ * Restarts (REST) and appends keep the existing data, and partial (ESTO A)
+ * uploads write at an offset; the underlying DSI handles those.
+ */
+static globus_bool_t
+osg_recv_is_partial(globus_gfs_transfer_info_t *transfer_info)
+{
+    if (!transfer_info->truncate || transfer_info->partial_offset || (transfer_info->partial_length > 0)) {
+        return GLOBUS_TRUE;
+    }
+    if (transfer_info->range_list && globus_range_list_size(transfer_info->range_list)) {
+        globus_off_t offset, length;
+        globus_range_list_at(transfer_info->range_list, 0, &offset, &length);
+        if (offset || (globus_range_list_size(transfer_info->range_list) > 1)) {return GLOBUS_TRUE;}
+    }
+    return GLOBUS_FALSE;
+}
+
+
+// Mode for new files: the server's `perms` setting, or 0644.
+static mode_t
+osg_recv_file_mode(void)
+{
+    const char *perms = globus_gfs_config_get_string("perms");
+    if (perms && *perms) {
+        char *end;
+        long mode = strtol(perms, &end, 8);
+        if (!*end && (mode >= 0) && (mode <= 07777)) {return mode;}
+    }
+    return 0644;
+}
+
+
+// Continues osg_recv() once the storage back-pressure check has passed.
+static void
+osg_recv_admitted(
+    globus_gfs_operation_t              op,
+    globus_gfs_transfer_info_t *        transfer_info,
+    void *                              user_arg,
+    globus_result_t                     result)
+{
+    GlobusGFSName(osg_recv_admitted);
+
+    if (result == GLOBUS_SUCCESS) {
+        result = osg_quota_check(osg_session_username, transfer_info->pathname,
+                                 transfer_info->alloc_size > 0 ? transfer_info->alloc_size : -1);
+    }
+    if (result != GLOBUS_SUCCESS) {
+        globus_gridftp_server_finished_transfer(op, result);
+        return;
+    }
+
+    // Transfers involving an ERET/ESTO module, an expected checksum to
+    // verify, or an offset are left entirely to the underlying DSI.
+    if (!osg_dsi_is_file || transfer_info->module_name || transfer_info->expected_checksum ||
+        osg_recv_is_partial(transfer_info))
+    {
+        osg_listing_cache_invalidate_pending(transfer_info->pathname);
+        original_recv_function(op, transfer_info, user_arg);
+        return;
+    }
+    osg_listing_cache_invalidate(transfer_info->pathname);
+    osg_write_policy_t policy;
+    osg_write_policy_lookup(transfer_info->pathname, &policy);
+    osg_checksum_t *cksm = osg_checksum_create();
+    globus_off_t small_size = osg_small_file_threshold();
+    if ((transfer_info->alloc_size <= 0) || (transfer_info->alloc_size > small_size)) {small_size = 0;}
+    if (!cksm && !small_size && !policy.prealloc && !policy.gather_size && !policy.writebehind_size)
+    {
+        original_recv_function(op, transfer_info, user_arg);
+        return;
+    }
+
+    osg_recv_monitor_t *monitor = (osg_recv_monitor_t *)globus_calloc(1, sizeof(osg_recv_monitor_t));
+    if (!monitor) {
+        if (cksm) {osg_checksum_destroy(cksm);}
+        result = GlobusGFSErrorMemory("recv monitor");
+        osg_quota_finished(0);
+        globus_gridftp_server_finished_transfer(op, result);
+        return;
+    }
+    globus_mutex_init(&monitor->mutex, NULL);
+    monitor->op = op;
+    monitor->cksm = cksm;
+    monitor->policy = policy;
+    monitor->fd = -1;
+    monitor->result = GLOBUS_SUCCESS;
+    monitor->pathname = globus_libc_strdup(transfer_info->pathname);
+    if (!monitor->pathname) {
+        osg_recv_monitor_destroy(monitor);
+        result = GlobusGFSErrorMemory("recv pathname");
+        osg_quota_finished(0);
+        globus_gridftp_server_finished_transfer(op, result);
+        return;
+    }
+
+    // Inline checksums may need to read back blocks which arrived early.
+    int flags = (cksm ? O_RDWR : O_WRONLY) | O_CREAT;
+    if (transfer_info->truncate) {flags |= O_TRUNC;}
+    monitor->fd = open(monitor->pathname, flags, osg_recv_file_mode());
+    if (monitor->fd == -1) {
+        result = GlobusGFSErrorSystemError("open", errno);
+        osg_recv_monitor_destroy(monitor);
+        osg_quota_finished(0);
+        globus_gridftp_server_finished_transfer(op, result);
+        return;
+    }
+
+    // Reserve space for the size announced by ALLO without changing the
+    // file size; failure (e.g., unsupported by the filesystem) is harmless.
+    if (policy.prealloc && (transfer_info->alloc_size > 0)) {
+        if (fallocate(monitor->fd, FALLOC_FL_KEEP_SIZE, 0, transfer_info->alloc_size) == -1) {
+            globus_gfs_log_message(GLOBUS_GFS_LOG_DUMP, "Unable to preallocate %s: %s\n", monitor->pathname, strerror(errno));
+        }
+    }
+
+    globus_gridftp_server_begin_transfer(op, 0, NULL);
+
+    int optimal_count = 2;
+    globus_gridftp_server_get_optimal_concurrency(op, &optimal_count);
+    globus_gridftp_server_get_block_size(op, &monitor->block_size);
+    if (optimal_count < 1) {optimal_count = 1;}
+
+    // Gathering only helps if the window holds several blocks.
+    if (small_size) {
+        monitor->gather_buffer = osg_buffer_get(small_size);
+        monitor->gather_size = small_size;
+        monitor->small_file = monitor->gather_buffer != NULL;
+    }
+    if (!monitor->gather_buffer && (policy.gather_size > (globus_off_t)monitor->block_size)) {
+        monitor->gather_buffer = (globus_byte_t *)globus_malloc(policy.gather_size);
+        monitor->gather_size = policy.gather_size;
+    }
+    if (monitor->gather_buffer) {globus_range_list_init(&monitor->gather_ranges);}
+    if (policy.writebehind_size) {globus_range_list_init(&monitor->wb_ranges);}
+
+    globus_bool_t finished = GLOBUS_FALSE;
+    globus_mutex_lock(&monitor->mutex);
+    {
+        int idx;
+        for (idx = 0; idx < optimal_count; idx++) {
+            globus_byte_t *buffer = (globus_byte_t *)globus_malloc(monitor->block_size);
+            if (!buffer) {
+                if (monitor->result == GLOBUS_SUCCESS) {monitor->result = GlobusGFSErrorMemory("recv buffer");}
+                break;
+            }
+            osg_recv_register(monitor, buffer);
+            if (monitor->result != GLOBUS_SUCCESS) {break;}
+        }
+        finished = monitor->outstanding == 0;
+    }
+    globus_mutex_unlock(&monitor->mutex);
+
+    // Nothing was registered; no callback will ever clean up.
+    if (finished) {
+        result = monitor->result;
+        osg_recv_monitor_destroy(monitor);
+        osg_quota_finished(0);
+        globus_gridftp_server_finished_transfer(op, result);
+    }
+}
+
+
+void
+osg_recv(
+    globus_gfs_operation_t              op,
+    globus_gfs_transfer_info_t *        transfer_info,
+    void *                              user_arg)
+{
+    osg_listing_cache_settle();
+    osg_pressure_check(op, transfer_info, user_arg, osg_recv_admitted);
+}
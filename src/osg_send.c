@@ -0,0 +1,687 @@
+
+#include "osg_extensions.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/*************************************************************************
+ * osg_send
+ * --------
+ * Read pipeline for downloads.  The 'file' DSI reads one block at a time per
+ * stream; here we keep several reads in flight per stream so the disk
+ * always has work queued while the network drains the previous blocks.
+ *
+ * Reads go into pooled aligned buffers which are handed straight to
+ * globus_gridftp_server_register_write() and recycled in the write callback.
+ * Reads are issued through io_uring where available (OSG_READ_PIPELINE=uring)
+ * or a small per-process pool of reader threads (OSG_READ_PIPELINE=threads,
+ * and the fallback when io_uring cannot be set up).
+ *
+ * Reads complete in any order, but writes are registered strictly in the
+ * order the reads were issued: in stream mode (MODE S) the data channel
+ * sends blocks in registration order and ignores the offsets.  Completed
+ * reads wait in a list sorted by sequence number until their turn.  Once a
+ * read comes back short (the file shrank), no more reads are issued and any
+ * still in flight past it are dropped.
+ *
+ * The reader and completion threads are not Globus threads and never call
+ * into Globus themselves: each completed read is handed back to the Globus
+ * callback system with globus_callback_register_oneshot(), and the write is
+ * registered from there.  That is only safe when Globus itself runs
+ * threaded; a non-threaded server leaves downloads to the underlying DSI.
+ * Pipeline state is guarded by pthread mutexes, since globus_mutex_t is a
+ * no-op in a non-threaded build.
+ *
+ * The read-ahead depth is the optimal concurrency for the session times
+ * OSG_READ_AHEAD_FACTOR (default 2) blocks.
+ *
+ * Files no larger than OSG_SMALL_FILE_THRESHOLD skip all of this: the whole
+ * file is read with one pread() into a pooled buffer and handed to the data
+ * channel with one write registration per requested range (normally one).
+ *************************************************************************/
+
+#define OSG_READ_AHEAD_DEFAULT_FACTOR 2
+#define OSG_READ_THREADS_DEFAULT 4
+#define OSG_URING_ENTRIES 256
+
+typedef struct osg_send_monitor_s osg_send_monitor_t;
+
+typedef struct osg_read_req_s {
+    osg_send_monitor_t *monitor;
+    globus_byte_t *buffer;
+    globus_size_t length;
+    globus_off_t offset;
+    ssize_t nread;
+    int error;
+    // Issue order; writes are registered in this order.
+    int seq;
+    // Read queue while pending, completed list once done.
+    struct osg_read_req_s *next;
+} osg_read_req_t;
+
+struct osg_send_monitor_s {
+    pthread_mutex_t mutex;
+    globus_gfs_operation_t op;
+    int fd;
+    globus_size_t block_size;
+    int depth;
+    int outstanding;
+    globus_off_t read_offset;
+    globus_off_t read_end;
+    globus_bool_t read_done;
+    // A read came back short; later reads are past the end of the file.
+    globus_bool_t eof;
+    int next_seq;
+    int write_seq;
+    // Completed reads waiting for earlier ones, sorted by seq.
+    osg_read_req_t *completed;
+    globus_bool_t finished;
+    globus_result_t result;
+};
+
+typedef enum {
+    OSG_READ_ENGINE_NONE,
+    OSG_READ_ENGINE_THREADS,
+    OSG_READ_ENGINE_URING
+} osg_read_engine_t;
+
+static osg_read_engine_t osg_read_engine = OSG_READ_ENGINE_NONE;
+static int osg_read_ahead_factor = OSG_READ_AHEAD_DEFAULT_FACTOR;
+
+static pthread_mutex_t osg_read_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t osg_read_queue_cond = PTHREAD_COND_INITIALIZER;
+static osg_read_req_t *osg_read_queue_head = NULL;
+static osg_read_req_t *osg_read_queue_tail = NULL;
+static globus_bool_t osg_read_engine_started = GLOBUS_FALSE;
+
+#ifdef HAVE_LIBURING
+static struct io_uring osg_ring;
+#endif
+
+static void
+osg_send_read_complete(osg_read_req_t *req);
+
+
+static void *
+osg_read_thread(void *arg)
+{
+    while (1) {
+        pthread_mutex_lock(&osg_read_queue_mutex);
+        while (!osg_read_queue_head) {
+            pthread_cond_wait(&osg_read_queue_cond, &osg_read_queue_mutex);
+        }
+        osg_read_req_t *req = osg_read_queue_head;
+        osg_read_queue_head = req->next;
+        if (!osg_read_queue_head) {osg_read_queue_tail = NULL;}
+        pthread_mutex_unlock(&osg_read_queue_mutex);
+
+        do {
+            req->nread = pread(req->monitor->fd, req->buffer, req->length, req->offset);
+        } while ((req->nread == -1) && (errno == EINTR));
+        req->error = (req->nread == -1) ? errno : 0;
+        osg_send_read_complete(req);
+    }
+    return NULL;
+}
+
+
+#ifdef HAVE_LIBURING
+static void *
+osg_uring_thread(void *arg)
+{
+    while (1) {
+        struct io_uring_cqe *cqe;
+        int retval = io_uring_wait_cqe(&osg_ring, &cqe);
+        if (retval == -EINTR) {continue;}
+        if (retval < 0) {
+            fprintf(stderr, "io_uring completion wait failed: %s\n", strerror(-retval));
+            return NULL;
+        }
+        osg_read_req_t *req = (osg_read_req_t *)io_uring_cqe_get_data(cqe);
+        req->nread = cqe->res < 0 ? -1 : cqe->res;
+        req->error = cqe->res < 0 ? -cqe->res : 0;
+        io_uring_cqe_seen(&osg_ring, cqe);
+        osg_send_read_complete(req);
+    }
+    return NULL;
+}
+#endif
+
+
+/*
+ * Start the reader threads (or the io_uring completion thread) the first
+ * time a pipelined transfer runs in this process.
+ */
+static globus_bool_t
+osg_read_engine_start(void)
+{
+    globus_bool_t started;
+    pthread_mutex_lock(&osg_read_queue_mutex);
+    if (osg_read_engine_started) {
+        started = osg_read_engine != OSG_READ_ENGINE_NONE;
+        pthread_mutex_unlock(&osg_read_queue_mutex);
+        return started;
+    }
+    osg_read_engine_started = GLOBUS_TRUE;
+
+    // Completions are handed back through the Globus callback system,
+    // which only runs other threads' callbacks in a threaded server.
+    if (globus_i_am_only_thread()) {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Read pipeline needs a threaded server (-threads); using the underlying DSI for downloads.\n");
+        osg_read_engine = OSG_READ_ENGINE_NONE;
+        pthread_mutex_unlock(&osg_read_queue_mutex);
+        return GLOBUS_FALSE;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t tid;
+
+#ifdef HAVE_LIBURING
+    if (osg_read_engine == OSG_READ_ENGINE_URING) {
+        int retval = io_uring_queue_init(OSG_URING_ENTRIES, &osg_ring, 0);
+        if (retval < 0) {
+            globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "io_uring unavailable (%s); using reader threads.\n", strerror(-retval));
+            osg_read_engine = OSG_READ_ENGINE_THREADS;
+        } else if (pthread_create(&tid, &attr, osg_uring_thread, NULL)) {
+            io_uring_queue_exit(&osg_ring);
+            osg_read_engine = OSG_READ_ENGINE_THREADS;
+        }
+    }
+#else
+    if (osg_read_engine == OSG_READ_ENGINE_URING) {
+        osg_read_engine = OSG_READ_ENGINE_THREADS;
+    }
+#endif
+
+    if (osg_read_engine == OSG_READ_ENGINE_THREADS) {
+        int thread_count = OSG_READ_THREADS_DEFAULT;
+        const char *threads_char = getenv("OSG_READ_PIPELINE_THREADS");
+        if (threads_char && (atoi(threads_char) > 0)) {thread_count = atoi(threads_char);}
+        int started_count = 0;
+        int idx;
+        for (idx = 0; idx < thread_count; idx++) {
+            if (!pthread_create(&tid, &attr, osg_read_thread, NULL)) {started_count++;}
+        }
+        if (!started_count) {
+            globus_gfs_log_message(GLOBUS_GFS_LOG_ERR, "Unable to start any reader threads; read pipeline disabled.\n");
+            osg_read_engine = OSG_READ_ENGINE_NONE;
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    started = osg_read_engine != OSG_READ_ENGINE_NONE;
+    pthread_mutex_unlock(&osg_read_queue_mutex);
+    return started;
+}
+
+
+static int
+osg_read_submit(osg_read_req_t *req)
+{
+#ifdef HAVE_LIBURING
+    if (osg_read_engine == OSG_READ_ENGINE_URING) {
+        pthread_mutex_lock(&osg_read_queue_mutex);
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&osg_ring);
+        if (!sqe) {
+            pthread_mutex_unlock(&osg_read_queue_mutex);
+            return EAGAIN;
+        }
+        io_uring_prep_read(sqe, req->monitor->fd, req->buffer, req->length, req->offset);
+        io_uring_sqe_set_data(sqe, req);
+        int retval = io_uring_submit(&osg_ring);
+        pthread_mutex_unlock(&osg_read_queue_mutex);
+        return retval < 0 ? -retval : 0;
+    }
+#endif
+
+    req->next = NULL;
+    pthread_mutex_lock(&osg_read_queue_mutex);
+    if (osg_read_queue_tail) {
+        osg_read_queue_tail->next = req;
+    } else {
+        osg_read_queue_head = req;
+    }
+    osg_read_queue_tail = req;
+    pthread_cond_signal(&osg_read_queue_cond);
+    pthread_mutex_unlock(&osg_read_queue_mutex);
+    return 0;
+}
+
+
+/*
+ * Queue reads until the pipeline is full or the requested ranges are
+ * exhausted.  Must be called with the monitor locked.
+ */
+static void
+osg_send_fill(osg_send_monitor_t *monitor)
+{
+    GlobusGFSName(osg_send_fill);
+
+    while (!monitor->read_done && (monitor->result == GLOBUS_SUCCESS) &&
+           (monitor->outstanding < monitor->depth))
+    {
+        if (monitor->read_offset >= monitor->read_end) {
+            globus_off_t length;
+            globus_gridftp_server_get_read_range(monitor->op, &monitor->read_offset, &length);
+            if (!length) {
+                monitor->read_done = GLOBUS_TRUE;
+                break;
+            }
+            struct stat st;
+            if (fstat(monitor->fd, &st) == -1) {
+                monitor->result = GlobusGFSErrorSystemError("fstat", errno);
+                break;
+            }
+            monitor->read_end = (length < 0) ? st.st_size : monitor->read_offset + length;
+            if (monitor->read_end > st.st_size) {monitor->read_end = st.st_size;}
+            if (monitor->read_offset >= monitor->read_end) {
+                monitor->read_done = GLOBUS_TRUE;
+                break;
+            }
+        }
+
+        osg_read_req_t *req = (osg_read_req_t *)globus_calloc(1, sizeof(osg_read_req_t));
+        globus_byte_t *buffer = osg_buffer_get(monitor->block_size);
+        if (!req || !buffer) {
+            if (req) {globus_free(req);}
+            osg_buffer_put(buffer, monitor->block_size);
+            monitor->result = GlobusGFSErrorMemory("read buffer");
+            break;
+        }
+        globus_off_t remaining = monitor->read_end - monitor->read_offset;
+        req->monitor = monitor;
+        req->buffer = buffer;
+        req->offset = monitor->read_offset;
+        req->length = remaining < (globus_off_t)monitor->block_size ? remaining : monitor->block_size;
+        req->seq = monitor->next_seq;
+
+        int error = osg_read_submit(req);
+        if (error) {
+            osg_buffer_put(buffer, monitor->block_size);
+            globus_free(req);
+            monitor->result = GlobusGFSErrorSystemError("read submission", error);
+            break;
+        }
+        monitor->read_offset += req->length;
+        monitor->next_seq++;
+        monitor->outstanding++;
+    }
+}
+
+
+/*
+ * If nothing is in flight and nothing more will be, finish the transfer.
+ * Must be called with the monitor locked; returns GLOBUS_TRUE if the
+ * caller should call osg_send_finish() after unlocking.
+ */
+static globus_bool_t
+osg_send_check_finished(osg_send_monitor_t *monitor)
+{
+    if (monitor->finished || monitor->outstanding) {return GLOBUS_FALSE;}
+    if (!monitor->read_done && (monitor->result == GLOBUS_SUCCESS)) {return GLOBUS_FALSE;}
+    monitor->finished = GLOBUS_TRUE;
+    return GLOBUS_TRUE;
+}
+
+
+static void
+osg_send_finish(osg_send_monitor_t *monitor)
+{
+    globus_gfs_operation_t op = monitor->op;
+    globus_result_t result = monitor->result;
+    close(monitor->fd);
+    pthread_mutex_destroy(&monitor->mutex);
+    globus_free(monitor);
+    globus_gridftp_server_finished_transfer(op, result);
+}
+
+
+static void
+osg_send_write_cb(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result,
+    globus_byte_t *                     buffer,
+    globus_size_t                       nbytes,
+    void *                              user_arg)
+{
+    osg_send_monitor_t *monitor = (osg_send_monitor_t *)user_arg;
+    globus_bool_t finished;
+
+    pthread_mutex_lock(&monitor->mutex);
+    {
+        osg_buffer_put(buffer, monitor->block_size);
+        monitor->outstanding--;
+        if ((result != GLOBUS_SUCCESS) && (monitor->result == GLOBUS_SUCCESS)) {
+            monitor->result = result;
+        }
+        osg_send_fill(monitor);
+        finished = osg_send_check_finished(monitor);
+    }
+    pthread_mutex_unlock(&monitor->mutex);
+
+    if (finished) {osg_send_finish(monitor);}
+}
+
+
+/*
+ * Register the write for `req`, the next read in issue order, or drop it.
+ * Must be called with the monitor locked.
+ */
+static void
+osg_send_register(osg_send_monitor_t *monitor, osg_read_req_t *req)
+{
+    GlobusGFSName(osg_send_register);
+    globus_byte_t *buffer = req->buffer;
+    globus_bool_t past_eof = monitor->eof;
+    if (req->nread == -1) {
+        if (monitor->result == GLOBUS_SUCCESS) {
+            monitor->result = GlobusGFSErrorSystemError("pread", req->error);
+        }
+    } else if (!past_eof && ((globus_size_t)req->nread < req->length)) {
+        // File shrank underneath us; finish what we have.
+        monitor->eof = GLOBUS_TRUE;
+    }
+
+    globus_result_t result = GLOBUS_FAILURE;
+    if ((monitor->result == GLOBUS_SUCCESS) && !past_eof && (req->nread > 0)) {
+        result = globus_gridftp_server_register_write(monitor->op,
+                     buffer,
+                     req->nread,
+                     req->offset,
+                     -1,
+                     osg_send_write_cb,
+                     monitor);
+        if (result != GLOBUS_SUCCESS) {monitor->result = result;}
+    }
+    if (result != GLOBUS_SUCCESS) {
+        osg_buffer_put(buffer, monitor->block_size);
+        monitor->outstanding--;
+    }
+    globus_free(req);
+}
+
+
+/*
+ * Completion of a read, run from the Globus callback system.
+ */
+static void
+osg_send_read_done(void *user_arg)
+{
+    osg_read_req_t *req = (osg_read_req_t *)user_arg;
+    osg_send_monitor_t *monitor = req->monitor;
+    globus_bool_t finished;
+
+    pthread_mutex_lock(&monitor->mutex);
+    {
+        // Stop issuing reads as soon as any of them reaches the end.
+        if ((req->nread != -1) && ((globus_size_t)req->nread < req->length)) {
+            monitor->read_done = GLOBUS_TRUE;
+        }
+
+        osg_read_req_t **prev = &monitor->completed;
+        while (*prev && ((*prev)->seq < req->seq)) {prev = &(*prev)->next;}
+        req->next = *prev;
+        *prev = req;
+
+        while (monitor->completed && (monitor->completed->seq == monitor->write_seq)) {
+            osg_read_req_t *next_req = monitor->completed;
+            monitor->completed = next_req->next;
+            monitor->write_seq++;
+            osg_send_register(monitor, next_req);
+        }
+        finished = osg_send_check_finished(monitor);
+    }
+    pthread_mutex_unlock(&monitor->mutex);
+
+    if (finished) {osg_send_finish(monitor);}
+}
+
+
+/*
+ * Completion of a read; called from a reader or completion thread, which
+ * must not call into the server, so the rest happens in a Globus callback.
+ */
+static void
+osg_send_read_complete(osg_read_req_t *req)
+{
+    // Registration only fails for lack of memory; the transfer cannot
+    // finish without this completion, so keep trying.
+    struct timespec delay = {0, 10 * 1000 * 1000};
+    while (globus_callback_register_oneshot(NULL, NULL, osg_send_read_done, req) != GLOBUS_SUCCESS) {
+        nanosleep(&delay, NULL);
+    }
+}
+
+
+typedef struct {
+    globus_mutex_t mutex;
+    globus_gfs_operation_t op;
+    globus_byte_t *buffer;
+    globus_size_t buffer_size;
+    int outstanding;
+    globus_bool_t registered;
+    globus_result_t result;
+} osg_small_send_t;
+
+
+static void
+osg_small_send_finish(osg_small_send_t *small)
+{
+    globus_gfs_operation_t op = small->op;
+    globus_result_t result = small->result;
+    osg_buffer_put(small->buffer, small->buffer_size);
+    globus_mutex_destroy(&small->mutex);
+    globus_free(small);
+    globus_gridftp_server_finished_transfer(op, result);
+}
+
+
+static void
+osg_small_send_write_cb(
+    globus_gfs_operation_t              op,
+    globus_result_t                     result,
+    globus_byte_t *                     buffer,
+    globus_size_t                       nbytes,
+    void *                              user_arg)
+{
+    osg_small_send_t *small = (osg_small_send_t *)user_arg;
+    globus_bool_t finished;
+
+    globus_mutex_lock(&small->mutex);
+    {
+        small->outstanding--;
+        if ((result != GLOBUS_SUCCESS) && (small->result == GLOBUS_SUCCESS)) {
+            small->result = result;
+        }
+        finished = small->registered && !small->outstanding;
+    }
+    globus_mutex_unlock(&small->mutex);
+
+    if (finished) {osg_small_send_finish(small);}
+}
+
+
+/*
+ * Send the `size`-byte file open on `fd` from memory.  Takes ownership of
+ * `fd`.
+ */
+static void
+osg_small_send(globus_gfs_operation_t op, int fd, globus_off_t size)
+{
+    GlobusGFSName(osg_small_send);
+    globus_result_t result = GLOBUS_SUCCESS;
+
+    osg_small_send_t *small = (osg_small_send_t *)globus_calloc(1, sizeof(osg_small_send_t));
+    globus_size_t buffer_size = osg_small_file_threshold();
+    globus_byte_t *buffer = osg_buffer_get(buffer_size);
+    if (!small || !buffer) {
+        if (small) {globus_free(small);}
+        osg_buffer_put(buffer, buffer_size);
+        close(fd);
+        result = GlobusGFSErrorMemory("small file buffer");
+        globus_gridftp_server_finished_transfer(op, result);
+        return;
+    }
+
+    globus_off_t nread = 0;
+    while (nread < size) {
+        ssize_t retval = pread(fd, buffer + nread, size - nread, nread);
+        if (retval == -1) {
+            if (errno == EINTR) {continue;}
+            result = GlobusGFSErrorSystemError("pread", errno);
+            break;
+        }
+        // File shrank underneath us; send what we have.
+        if (!retval) {break;}
+        nread += retval;
+    }
+    close(fd);
+    if (result != GLOBUS_SUCCESS) {
+        osg_buffer_put(buffer, buffer_size);
+        globus_free(small);
+        globus_gridftp_server_finished_transfer(op, result);
+        return;
+    }
+
+    globus_mutex_init(&small->mutex, NULL);
+    small->op = op;
+    small->buffer = buffer;
+    small->buffer_size = buffer_size;
+    small->result = GLOBUS_SUCCESS;
+
+    globus_gridftp_server_begin_transfer(op, 0, NULL);
+
+    globus_bool_t finished;
+    globus_mutex_lock(&small->mutex);
+    {
+        while (small->result == GLOBUS_SUCCESS) {
+            globus_off_t offset, length;
+            globus_gridftp_server_get_read_range(op, &offset, &length);
+            if (!length) {break;}
+            globus_off_t end = ((length < 0) || (offset + length > nread)) ? nread : offset + length;
+            if (offset >= end) {continue;}
+            result = globus_gridftp_server_register_write(op,
+                         buffer + offset,
+                         end - offset,
+                         offset,
+                         -1,
+                         osg_small_send_write_cb,
+                         small);
+            if (result != GLOBUS_SUCCESS) {
+                small->result = result;
+                break;
+            }
+            small->outstanding++;
+        }
+        small->registered = GLOBUS_TRUE;
+        finished = !small->outstanding;
+    }
+    globus_mutex_unlock(&small->mutex);
+
+    if (finished) {osg_small_send_finish(small);}
+}
+
+
+void
+osg_send_init(void)
+{
+    const char *engine_char = getenv("OSG_READ_PIPELINE");
+    if (!engine_char || !*engine_char) {return;}
+    if (!strcasecmp(engine_char, "uring")) {
+        osg_read_engine = OSG_READ_ENGINE_URING;
+    } else if (!strcasecmp(engine_char, "threads")) {
+        osg_read_engine = OSG_READ_ENGINE_THREADS;
+    } else {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_WARN, "Unknown OSG_READ_PIPELINE value %s; read pipeline disabled.\n", engine_char);
+        return;
+    }
+    const char *factor_char = getenv("OSG_READ_AHEAD_FACTOR");
+    if (factor_char && (atoi(factor_char) > 0)) {
+        osg_read_ahead_factor = atoi(factor_char);
+    }
+}
+
+
+void
+osg_send(
+    globus_gfs_operation_t              op,
+    globus_gfs_transfer_info_t *        transfer_info,
+    void *                              user_arg)
+{
+    GlobusGFSName(osg_send);
+    globus_result_t result;
+
+    // Any upload before this one has finished.
+    osg_quota_release();
+    osg_listing_cache_settle();
+
+    if (!osg_dsi_is_file || transfer_info->module_name) {
+        original_send_function(op, transfer_info, user_arg);
+        return;
+    }
+
+    if (osg_small_file_threshold()) {
+        int fd = open(transfer_info->pathname, O_RDONLY);
+        struct stat st;
+        if ((fd != -1) && (fstat(fd, &st) == 0) && S_ISREG(st.st_mode) &&
+            (st.st_size <= osg_small_file_threshold()))
+        {
+            osg_small_send(op, fd, st.st_size);
+            return;
+        }
+        if (fd != -1) {close(fd);}
+    }
+
+    if ((osg_read_engine == OSG_READ_ENGINE_NONE) || !osg_read_engine_start()) {
+        original_send_function(op, transfer_info, user_arg);
+        return;
+    }
+
+    osg_send_monitor_t *monitor = (osg_send_monitor_t *)globus_calloc(1, sizeof(osg_send_monitor_t));
+    if (!monitor) {
+        result = GlobusGFSErrorMemory("send monitor");
+        globus_gridftp_server_finished_transfer(op, result);
+        return;
+    }
+    monitor->fd = open(transfer_info->pathname, O_RDONLY);
+    if (monitor->fd == -1) {
+        result = GlobusGFSErrorSystemError("open", errno);
+        globus_free(monitor);
+        globus_gridftp_server_finished_transfer(op, result);
+        return;
+    }
+    pthread_mutex_init(&monitor->mutex, NULL);
+    monitor->op = op;
+    monitor->result = GLOBUS_SUCCESS;
+
+    globus_gridftp_server_begin_transfer(op, 0, NULL);
+
+    int optimal_count = 2;
+    globus_gridftp_server_get_optimal_concurrency(op, &optimal_count);
+    globus_gridftp_server_get_block_size(op, &monitor->block_size);
+    if (optimal_count < 1) {optimal_count = 1;}
+    monitor->depth = optimal_count * osg_read_ahead_factor;
+#ifdef HAVE_LIBURING
+    if ((osg_read_engine == OSG_READ_ENGINE_URING) && (monitor->depth > OSG_URING_ENTRIES)) {
+        monitor->depth = OSG_URING_ENTRIES;
+    }
+#endif
+
+    globus_bool_t finished;
+    pthread_mutex_lock(&monitor->mutex);
+    {
+        osg_send_fill(monitor);
+        finished = osg_send_check_finished(monitor);
+    }
+    pthread_mutex_unlock(&monitor->mutex);
+
+    if (finished) {osg_send_finish(monitor);}
+}
@@ -0,0 +1,354 @@
+
+#include "osg_extensions.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+/*************************************************************************
+ * osg_stat
+ * --------
+ * Listing engine for large directories.  The 'file' DSI lists a directory
+ * by reading every entry, stat'ing each one in turn, and replying only once
+ * the whole listing is built in memory.  With OSG_BULK_STAT set, directory
+ * listings are instead read with getdents64, the entries of each chunk of
+ * OSG_BULK_STAT_CHUNK names are stat'ed by OSG_BULK_STAT_THREADS threads
+ * in parallel (using statx for just the fields a listing reports), and
+ * each chunk is sent with globus_gridftp_server_finished_stat_partial() as
+ * soon as it is ready.
+ *
+ * Anything other than a plain directory listing -- a single file, or a
+ * directory the session cannot open -- is left to the underlying DSI so
+ * that responses and error messages are unchanged.
+ *
+ * With OSG_LISTING_CACHE set, listings are also shared between sessions
+ * through osg_listing_cache.c, and single-file stats are answered from
+ * the cached listing of the parent directory when there is one.  The
+ * engine is then used for all listings, as it is what fills the cache.
+ *************************************************************************/
+
+#define OSG_BULK_STAT_DEFAULT_THREADS 8
+#define OSG_BULK_STAT_DEFAULT_CHUNK 1000
+#define OSG_GETDENTS_BUFFER_SIZE (64*1024)
+
+// As returned by getdents64(2); not declared by older glibc.
+struct osg_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    int dir_fd;
+    globus_bool_t use_symlink_info;
+    globus_gfs_stat_t *entries;
+    int count;
+    int next;
+    int failed;
+    pthread_mutex_t mutex;
+} osg_stat_chunk_t;
+
+static globus_bool_t osg_bulk_stat_enabled = GLOBUS_FALSE;
+static int osg_bulk_stat_threads = OSG_BULK_STAT_DEFAULT_THREADS;
+static int osg_bulk_stat_chunk = OSG_BULK_STAT_DEFAULT_CHUNK;
+
+
+/*
+ * stat `name` relative to `dir_fd`, filling only the fields a listing
+ * needs.  Returns 0 or an errno value.
+ */
+static int
+osg_stat_at(int dir_fd, const char *name, int flags, struct stat *st)
+{
+#ifdef STATX_BASIC_STATS
+    static globus_bool_t statx_unavailable = GLOBUS_FALSE;
+    if (!statx_unavailable) {
+        struct statx stx;
+        unsigned mask = STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID |
+                        STATX_ATIME | STATX_MTIME | STATX_CTIME | STATX_INO | STATX_SIZE;
+        if (statx(dir_fd, name, flags, mask, &stx) == 0) {
+            memset(st, '\0', sizeof(*st));
+            st->st_mode = stx.stx_mode;
+            st->st_nlink = stx.stx_nlink;
+            st->st_uid = stx.stx_uid;
+            st->st_gid = stx.stx_gid;
+            st->st_size = stx.stx_size;
+            st->st_atime = stx.stx_atime.tv_sec;
+            st->st_mtime = stx.stx_mtime.tv_sec;
+            st->st_ctime = stx.stx_ctime.tv_sec;
+            st->st_ino = stx.stx_ino;
+            st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+            return 0;
+        }
+        if (errno != ENOSYS) {return errno;}
+        statx_unavailable = GLOBUS_TRUE;
+    }
+#endif
+    return fstatat(dir_fd, name, st, flags) == 0 ? 0 : errno;
+}
+
+
+/*
+ * Fill in `entry` (whose name is already set) the way the 'file' DSI
+ * does: symlinks report their target, and unless the client asked for
+ * symlink information, the attributes of what they point at.
+ */
+static int
+osg_stat_entry(int dir_fd, globus_bool_t use_symlink_info, globus_gfs_stat_t *entry)
+{
+    struct stat st;
+    int error = osg_stat_at(dir_fd, entry->name, AT_SYMLINK_NOFOLLOW, &st);
+    if (error) {return error;}
+
+    if (S_ISLNK(st.st_mode)) {
+        char target[PATH_MAX];
+        ssize_t len = readlinkat(dir_fd, entry->name, target, sizeof(target) - 1);
+        if (len >= 0) {
+            target[len] = '\0';
+            entry->symlink_target = globus_libc_strdup(target);
+        }
+        struct stat target_st;
+        if (!use_symlink_info && !osg_stat_at(dir_fd, entry->name, 0, &target_st)) {
+            st = target_st;
+        }
+    }
+
+    entry->mode = st.st_mode;
+    entry->nlink = st.st_nlink;
+    entry->uid = st.st_uid;
+    entry->gid = st.st_gid;
+    entry->size = st.st_size;
+    entry->atime = st.st_atime;
+    entry->mtime = st.st_mtime;
+    entry->ctime = st.st_ctime;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    return 0;
+}
+
+
+static void *
+osg_stat_worker(void *arg)
+{
+    osg_stat_chunk_t *chunk = (osg_stat_chunk_t *)arg;
+    while (1) {
+        pthread_mutex_lock(&chunk->mutex);
+        int idx = chunk->next++;
+        pthread_mutex_unlock(&chunk->mutex);
+        if (idx >= chunk->count) {break;}
+
+        globus_gfs_stat_t *entry = &chunk->entries[idx];
+        if (osg_stat_entry(chunk->dir_fd, chunk->use_symlink_info, entry)) {
+            // Removed since it was read, most likely; drop it from the
+            // listing as the 'file' DSI would.
+            globus_free(entry->name);
+            entry->name = NULL;
+            pthread_mutex_lock(&chunk->mutex);
+            chunk->failed++;
+            pthread_mutex_unlock(&chunk->mutex);
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * stat every entry of the chunk in parallel, then compact out the ones
+ * which failed.
+ */
+static void
+osg_stat_chunk_fill(osg_stat_chunk_t *chunk)
+{
+    chunk->next = 0;
+    chunk->failed = 0;
+
+    int thread_count = osg_bulk_stat_threads;
+    if (thread_count > chunk->count) {thread_count = chunk->count;}
+    pthread_t tids[thread_count > 0 ? thread_count : 1];
+    int started = 0;
+    int idx;
+    // This thread works too, so at most thread_count - 1 helpers.
+    for (idx = 1; idx < thread_count; idx++) {
+        if (!pthread_create(&tids[started], NULL, osg_stat_worker, chunk)) {started++;}
+    }
+    osg_stat_worker(chunk);
+    for (idx = 0; idx < started; idx++) {
+        pthread_join(tids[idx], NULL);
+    }
+
+    if (chunk->failed) {
+        int kept = 0;
+        for (idx = 0; idx < chunk->count; idx++) {
+            if (chunk->entries[idx].name) {chunk->entries[kept++] = chunk->entries[idx];}
+        }
+        chunk->count = kept;
+    }
+}
+
+
+static void
+osg_stat_chunk_clear(osg_stat_chunk_t *chunk)
+{
+    int idx;
+    for (idx = 0; idx < chunk->count; idx++) {
+        if (chunk->entries[idx].name) {globus_free(chunk->entries[idx].name);}
+        if (chunk->entries[idx].symlink_target) {globus_free(chunk->entries[idx].symlink_target);}
+    }
+    memset(chunk->entries, '\0', osg_bulk_stat_chunk * sizeof(globus_gfs_stat_t));
+    chunk->count = 0;
+}
+
+
+void
+osg_stat_init(void)
+{
+    // The settings also apply when the engine runs for the listing cache.
+    osg_bulk_stat_enabled = getenv("OSG_BULK_STAT") != NULL;
+    const char *threads_char = getenv("OSG_BULK_STAT_THREADS");
+    if (threads_char && (atoi(threads_char) > 0)) {osg_bulk_stat_threads = atoi(threads_char);}
+    const char *chunk_char = getenv("OSG_BULK_STAT_CHUNK");
+    if (chunk_char && (atoi(chunk_char) > 0)) {osg_bulk_stat_chunk = atoi(chunk_char);}
+}
+
+
+/*
+ * Send a listing from the shared cache.  Returns GLOBUS_FALSE, having sent
+ * nothing, if the cached copy could not be read.
+ */
+static globus_bool_t
+osg_stat_send_cached(globus_gfs_operation_t op, osg_listing_cache_t *cache, osg_stat_chunk_t *chunk)
+{
+    GlobusGFSName(osg_stat_send_cached);
+    globus_result_t result = GLOBUS_SUCCESS;
+    globus_bool_t sent = GLOBUS_FALSE;
+
+    while (1) {
+        int count = osg_listing_cache_read(cache, chunk->entries, osg_bulk_stat_chunk);
+        if (count < 0) {
+            if (!sent) {return GLOBUS_FALSE;}
+            GlobusGFSErrorGenericStr(result, ("Cached directory listing is truncated"));
+            globus_gridftp_server_finished_stat(op, result, NULL, 0);
+            return GLOBUS_TRUE;
+        }
+        chunk->count = count;
+        if (count < osg_bulk_stat_chunk) {break;}
+        globus_gridftp_server_finished_stat_partial(op, GLOBUS_SUCCESS, chunk->entries, chunk->count);
+        osg_stat_chunk_clear(chunk);
+        sent = GLOBUS_TRUE;
+    }
+    globus_gridftp_server_finished_stat(op, GLOBUS_SUCCESS, chunk->entries, chunk->count);
+    osg_stat_chunk_clear(chunk);
+    return GLOBUS_TRUE;
+}
+
+
+void
+osg_stat(
+    globus_gfs_operation_t              op,
+    globus_gfs_stat_info_t *            stat_info,
+    void *                              user_arg)
+{
+    GlobusGFSName(osg_stat);
+    globus_result_t result = GLOBUS_SUCCESS;
+
+    // Any upload before this has finished.
+    osg_listing_cache_settle();
+
+    // The path's own entry (include_path_stat) is formatted by the
+    // underlying DSI; keep those listings there too.
+    if ((!osg_bulk_stat_enabled && !osg_listing_cache_enabled()) || !osg_dsi_is_file ||
+        stat_info->include_path_stat)
+    {
+        original_stat_function(op, stat_info, user_arg);
+        return;
+    }
+    if (stat_info->file_only) {
+        globus_gfs_stat_t entry;
+        if (osg_listing_cache_stat(stat_info->pathname, stat_info->use_symlink_info, &entry)) {
+            globus_gridftp_server_finished_stat(op, GLOBUS_SUCCESS, &entry, 1);
+            globus_free(entry.name);
+            if (entry.symlink_target) {globus_free(entry.symlink_target);}
+        } else {
+            original_stat_function(op, stat_info, user_arg);
+        }
+        return;
+    }
+    int dir_fd = open(stat_info->pathname, O_RDONLY | O_DIRECTORY);
+    struct stat dir_st;
+    if ((dir_fd != -1) && (fstat(dir_fd, &dir_st) == -1)) {
+        close(dir_fd);
+        dir_fd = -1;
+    }
+    if (dir_fd == -1) {
+        original_stat_function(op, stat_info, user_arg);
+        return;
+    }
+
+    osg_stat_chunk_t chunk;
+    memset(&chunk, '\0', sizeof(chunk));
+    chunk.dir_fd = dir_fd;
+    chunk.use_symlink_info = stat_info->use_symlink_info;
+    chunk.entries = (globus_gfs_stat_t *)globus_calloc(osg_bulk_stat_chunk, sizeof(globus_gfs_stat_t));
+    char *dents = (char *)globus_malloc(OSG_GETDENTS_BUFFER_SIZE);
+    if (!chunk.entries || !dents) {
+        if (chunk.entries) {globus_free(chunk.entries);}
+        if (dents) {globus_free(dents);}
+        close(dir_fd);
+        result = GlobusGFSErrorMemory("stat chunk");
+        globus_gridftp_server_finished_stat(op, result, NULL, 0);
+        return;
+    }
+    pthread_mutex_init(&chunk.mutex, NULL);
+
+    osg_listing_cache_t *cache = osg_listing_cache_open(stat_info->pathname, stat_info->use_symlink_info, &dir_st);
+    globus_bool_t done = cache && osg_stat_send_cached(op, cache, &chunk);
+    osg_listing_cache_close(cache);
+    cache = done ? NULL : osg_listing_cache_begin(stat_info->pathname, stat_info->use_symlink_info, &dir_st);
+
+    while (!done && (result == GLOBUS_SUCCESS)) {
+        long nread = syscall(SYS_getdents64, dir_fd, dents, OSG_GETDENTS_BUFFER_SIZE);
+        if (nread < 0) {
+            result = GlobusGFSErrorSystemError("getdents64", errno);
+            break;
+        }
+        long pos = 0;
+        while ((pos < nread) && (result == GLOBUS_SUCCESS)) {
+            struct osg_dirent64 *dent = (struct osg_dirent64 *)(dents + pos);
+            pos += dent->d_reclen;
+            chunk.entries[chunk.count].name = globus_libc_strdup(dent->d_name);
+            if (!chunk.entries[chunk.count].name) {
+                result = GlobusGFSErrorMemory("stat entry");
+                break;
+            }
+            chunk.count++;
+            if (chunk.count == osg_bulk_stat_chunk) {
+                osg_stat_chunk_fill(&chunk);
+                osg_listing_cache_append(cache, chunk.entries, chunk.count);
+                globus_gridftp_server_finished_stat_partial(op, GLOBUS_SUCCESS, chunk.entries, chunk.count);
+                osg_stat_chunk_clear(&chunk);
+            }
+        }
+        if (!nread) {break;}
+    }
+
+    if (done) {
+        // Sent from the cache.
+    } else if (result == GLOBUS_SUCCESS) {
+        osg_stat_chunk_fill(&chunk);
+        osg_listing_cache_append(cache, chunk.entries, chunk.count);
+        globus_gridftp_server_finished_stat(op, GLOBUS_SUCCESS, chunk.entries, chunk.count);
+        osg_listing_cache_commit(cache);
+    } else {
+        osg_listing_cache_abort(cache);
+        globus_gridftp_server_finished_stat(op, result, NULL, 0);
+    }
+
+    osg_stat_chunk_clear(&chunk);
+    pthread_mutex_destroy(&chunk.mutex);
+    globus_free(chunk.entries);
+    globus_free(dents);
+    close(dir_fd);
+}
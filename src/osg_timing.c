@@ -0,0 +1,168 @@
+
+#include "osg_extensions.h"
+
+#include <sys/mman.h>
+#include <string.h>
+
+/*************************************************************************
+ * Session start-up timing
+ * -----------------------
+ * Each phase of osg_extensions_init() is timed with the monotonic clock.
+ * The per-session breakdown goes to the TRANSFER log; sessions slower than
+ * OSG_SLOW_SESSION_MS additionally get an INFO line naming the user and the
+ * slowest phase.
+ *
+ * Durations are also accumulated into host-wide histograms in a shared
+ * file (OSG_STARTUP_HISTOGRAM_FILE) laid out as osg_startup_histogram_t:
+ * for each phase, a count, a sum in microseconds, and log2 buckets where
+ * bucket i counts durations in [2^i, 2^(i+1)) microseconds.
+ *************************************************************************/
+
+#define OSG_STARTUP_HISTOGRAM_MAGIC 0x4f534748  // "OSGH"
+#define OSG_STARTUP_HISTOGRAM_VERSION 2
+#define OSG_STARTUP_HISTOGRAM_BUCKETS 32
+#define OSG_STARTUP_HISTOGRAM_DEFAULT_FILE "/dev/shm/gridftp-osg-startup-histogram"
+
+static const char *osg_startup_phase_names[OSG_STARTUP_PHASE_COUNT] =
+{
+    "add_command",
+    "voms",
+    "limits_params",
+    "limits_wait",
+    "cgroup",
+    "dsi_init"
+};
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t buckets[OSG_STARTUP_HISTOGRAM_BUCKETS];
+} osg_startup_histogram_phase_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t phase_count;
+    uint32_t bucket_count;
+    osg_startup_histogram_phase_t phase[OSG_STARTUP_PHASE_COUNT];
+    osg_startup_histogram_phase_t total;
+} osg_startup_histogram_t;
+
+
+static uint64_t
+timespec_diff_us(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000ULL + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+
+void
+osg_startup_timer_start(osg_startup_timer_t *timer)
+{
+    memset(timer, '\0', sizeof(*timer));
+    clock_gettime(CLOCK_MONOTONIC, &timer->start);
+    timer->last = timer->start;
+}
+
+
+void
+osg_startup_timer_mark(osg_startup_timer_t *timer, osg_startup_phase_t phase)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timer->phase_us[phase] += timespec_diff_us(&timer->last, &now);
+    timer->last = now;
+}
+
+
+static void
+histogram_add(osg_startup_histogram_phase_t *phase, uint64_t duration_us)
+{
+    int bucket = 0;
+    while ((bucket < OSG_STARTUP_HISTOGRAM_BUCKETS - 1) && (duration_us >> (bucket + 1))) {bucket++;}
+    __sync_fetch_and_add(&phase->count, 1);
+    __sync_fetch_and_add(&phase->sum_us, duration_us);
+    __sync_fetch_and_add(&phase->buckets[bucket], 1);
+}
+
+
+/*
+ * Add this session to the shared histograms.  Failures are only logged;
+ * instrumentation must never prevent a session from starting.
+ */
+static void
+histogram_record(const osg_startup_timer_t *timer, uint64_t total_us)
+{
+    const char *fname = getenv("OSG_STARTUP_HISTOGRAM_FILE");
+    fname = fname ? fname : OSG_STARTUP_HISTOGRAM_DEFAULT_FILE;
+    if (!*fname) {return;}
+
+    int fd = open(fname, O_RDWR | O_CREAT, 0666);
+    if (fd == -1) {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_DUMP, "Unable to open start-up histogram %s: %s\n", fname, strerror(errno));
+        return;
+    }
+    fchmod(fd, 0666);
+    struct stat st;
+    if ((fstat(fd, &st) == -1) ||
+        ((st.st_size < (off_t)sizeof(osg_startup_histogram_t)) &&
+         (ftruncate(fd, sizeof(osg_startup_histogram_t)) == -1)))
+    {
+        close(fd);
+        return;
+    }
+    osg_startup_histogram_t *histogram = (osg_startup_histogram_t *)mmap(NULL,
+        sizeof(osg_startup_histogram_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (histogram == MAP_FAILED) {return;}
+
+    // A freshly-created file is all zeros; the first writer stamps the header.
+    // Files written with another phase layout are left alone.
+    __sync_bool_compare_and_swap(&histogram->magic, 0, OSG_STARTUP_HISTOGRAM_MAGIC);
+    __sync_bool_compare_and_swap(&histogram->version, 0, OSG_STARTUP_HISTOGRAM_VERSION);
+    if ((histogram->magic == OSG_STARTUP_HISTOGRAM_MAGIC) &&
+        (histogram->version == OSG_STARTUP_HISTOGRAM_VERSION))
+    {
+        histogram->phase_count = OSG_STARTUP_PHASE_COUNT;
+        histogram->bucket_count = OSG_STARTUP_HISTOGRAM_BUCKETS;
+        int idx;
+        for (idx = 0; idx < OSG_STARTUP_PHASE_COUNT; idx++) {
+            histogram_add(&histogram->phase[idx], timer->phase_us[idx]);
+        }
+        histogram_add(&histogram->total, total_us);
+    }
+    munmap(histogram, sizeof(osg_startup_histogram_t));
+}
+
+
+void
+osg_startup_timer_report(const osg_startup_timer_t *timer, const char *username)
+{
+    uint64_t total_us = timespec_diff_us(&timer->start, &timer->last);
+
+    char breakdown[512];
+    char *pos = breakdown;
+    int char_remaining = sizeof(breakdown);
+    int slowest = 0;
+    int idx;
+    for (idx = 0; idx < OSG_STARTUP_PHASE_COUNT && char_remaining > 0; idx++) {
+        int this_round = snprintf(pos, char_remaining, "%s=%.3fms ", osg_startup_phase_names[idx], timer->phase_us[idx] / 1000.0);
+        pos += this_round;
+        char_remaining -= this_round;
+        if (timer->phase_us[idx] > timer->phase_us[slowest]) {slowest = idx;}
+    }
+    if (char_remaining > 0) {
+        snprintf(pos, char_remaining, "total=%.3fms", total_us / 1000.0);
+    }
+    breakdown[sizeof(breakdown)-1] = '\0';
+
+    globus_gfs_log_message(GLOBUS_GFS_LOG_TRANSFER, "Session start-up timing: %s\n", breakdown);
+
+    const char *slow_char = getenv("OSG_SLOW_SESSION_MS");
+    if (slow_char && (atoi(slow_char) >= 0) && (total_us >= (uint64_t)atoi(slow_char) * 1000)) {
+        globus_gfs_log_message(GLOBUS_GFS_LOG_INFO, "Slow session start-up for %s (%.3fms, mostly %s): %s\n",
+            username ? username : "UNKNOWN", total_us / 1000.0, osg_startup_phase_names[slowest], breakdown);
+    }
+
+    histogram_record(timer, total_us);
+}
@@ -0,0 +1,970 @@
+
+/*************************************************************************
+ * dsi_harness
+ * -----------
+ * In-process test and benchmark of the OSG DSI.  A "stub" DSI, which
+ * completes every operation immediately, is registered in the DSI registry
+ * and the OSG module is loaded over it (OSG_EXTENSIONS_OVERRIDE_DSI=stub),
+ * exactly as the server would load it over the 'file' DSI.
+ *
+ * The globus_gridftp_server_* completion calls are provided here instead of
+ * by the server library (the harness exports its symbols, so the module
+ * binds to these), as are the malloc family, so each operation can be
+ * driven directly and its cost counted.  Every operation is run first
+ * against the stub and then through the OSG module; the difference is the
+ * latency and number of allocations the module adds per call.
+ *
+ * No server, network, or credentials are needed.  Exits non-zero if any
+ * operation does not complete correctly, or if the added latency of any
+ * operation exceeds OSG_HARNESS_MAX_ADDED_US (when set).
+ *
+ * With --files, the stub is registered as "file" instead, so the module
+ * takes its file-backed paths, and functional tests of those paths are run
+ * against a temporary directory: inline checksums of blocks arriving out of
+ * order (through gather and write-behind), restarted uploads, listing cache
+ * permissions and invalidation, and the quota ledger.  The data of an upload is fed to the
+ * module by hand through globus_gridftp_server_register_read().
+ *************************************************************************/
+
+#include "globus_gridftp_server.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define HARNESS_DEFAULT_ITERATIONS 10000
+// SITE USAGE runs a script per call.
+#define HARNESS_USAGE_ITERATIONS 100
+// Uploads in --files mode.
+#define HARNESS_BLOCK_SIZE 1024
+#define HARNESS_CONCURRENCY 4
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static volatile unsigned long harness_allocs = 0;
+
+void *
+malloc(size_t size)
+{
+    __sync_fetch_and_add(&harness_allocs, 1);
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    __sync_fetch_and_add(&harness_allocs, 1);
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    __sync_fetch_and_add(&harness_allocs, 1);
+    return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+
+/*
+ * Server side: record how each operation was completed.
+ */
+static struct {
+    int finished;
+    globus_result_t result;
+    char response[256];
+    int stat_count;
+    // Size of the listed entry named stat_name, or -1 if not seen.
+    const char *stat_name;
+    globus_off_t stat_size;
+} harness_op;
+
+// Reads registered by the module and not yet completed (--files mode).
+typedef struct {
+    globus_byte_t *buffer;
+    globus_size_t length;
+    globus_gridftp_server_read_cb_t callback;
+    void *user_arg;
+} harness_read_t;
+
+static harness_read_t harness_reads[HARNESS_CONCURRENCY * 2];
+static int harness_read_count = 0;
+
+// Set while the OSG module (rather than the stub alone) is being measured.
+static int harness_running_module = 0;
+
+static char *harness_argv[5];
+static int harness_argc = 0;
+
+// Stands in for the server's operation handle; never dereferenced.
+static int harness_op_token;
+#define HARNESS_OP ((globus_gfs_operation_t)&harness_op_token)
+
+static void
+harness_op_reset(void)
+{
+    memset(&harness_op, '\0', sizeof(harness_op));
+    harness_op.stat_size = -1;
+    harness_read_count = 0;
+}
+
+void
+globus_gfs_log_message(globus_gfs_log_type_t type, const char *format, ...)
+{
+    if (getenv("OSG_HARNESS_VERBOSE")) {
+        va_list ap;
+        va_start(ap, format);
+        vfprintf(stderr, format, ap);
+        va_end(ap);
+    }
+}
+
+globus_result_t
+globus_gridftp_server_add_command(globus_gfs_operation_t op, const char *command_name, int cmd_id,
+    int min_args, int max_args, const char *help_string, globus_bool_t has_pathname, int access_type)
+{
+    return GLOBUS_SUCCESS;
+}
+
+globus_result_t
+globus_gridftp_server_query_op_info(globus_gfs_operation_t op, globus_gfs_op_info_t op_info,
+    globus_gfs_op_info_param_t param, ...)
+{
+    if (param != GLOBUS_GFS_OP_INFO_CMD_ARGS) {return GLOBUS_FAILURE;}
+    va_list ap;
+    va_start(ap, param);
+    char ***argv = va_arg(ap, char ***);
+    int *argc = va_arg(ap, int *);
+    va_end(ap);
+    *argv = harness_argv;
+    *argc = harness_argc;
+    return GLOBUS_SUCCESS;
+}
+
+void
+globus_gridftp_server_finished_session_start(globus_gfs_operation_t op, globus_result_t result,
+    void *session_arg, char *username, char *home_dir)
+{
+    harness_op.finished++;
+    harness_op.result = result;
+}
+
+void
+globus_gridftp_server_finished_command(globus_gfs_operation_t op, globus_result_t result, char *command_response)
+{
+    harness_op.finished++;
+    harness_op.result = result;
+    if (command_response) {
+        strncpy(harness_op.response, command_response, sizeof(harness_op.response) - 1);
+    }
+}
+
+static void
+harness_record_stat(globus_gfs_stat_t *stat_array, int stat_count)
+{
+    harness_op.stat_count += stat_count;
+    int idx;
+    for (idx = 0; harness_op.stat_name && (idx < stat_count); idx++) {
+        if (stat_array[idx].name && !strcmp(stat_array[idx].name, harness_op.stat_name)) {
+            harness_op.stat_size = stat_array[idx].size;
+        }
+    }
+}
+
+void
+globus_gridftp_server_finished_stat(globus_gfs_operation_t op, globus_result_t result,
+    globus_gfs_stat_t *stat_array, int stat_count)
+{
+    harness_op.finished++;
+    harness_op.result = result;
+    harness_record_stat(stat_array, stat_count);
+}
+
+void
+globus_gridftp_server_finished_stat_partial(globus_gfs_operation_t op, globus_result_t result,
+    globus_gfs_stat_t *stat_array, int stat_count)
+{
+    harness_record_stat(stat_array, stat_count);
+}
+
+void
+globus_gridftp_server_finished_transfer(globus_gfs_operation_t op, globus_result_t result)
+{
+    harness_op.finished++;
+    harness_op.result = result;
+}
+
+void
+globus_gridftp_server_begin_transfer(globus_gfs_operation_t op, int event_mask, void *event_arg)
+{
+}
+
+void
+globus_gridftp_server_get_block_size(globus_gfs_operation_t op, globus_size_t *block_size)
+{
+    *block_size = HARNESS_BLOCK_SIZE;
+}
+
+void
+globus_gridftp_server_get_optimal_concurrency(globus_gfs_operation_t op, int *count)
+{
+    *count = HARNESS_CONCURRENCY;
+}
+
+void
+globus_gridftp_server_update_bytes_written(globus_gfs_operation_t op, globus_off_t offset, globus_off_t length)
+{
+}
+
+// No server configuration: the module's defaults apply.
+char *
+globus_gfs_config_get_string(const char *option_name)
+{
+    return NULL;
+}
+
+globus_result_t
+globus_gridftp_server_register_read(globus_gfs_operation_t op, globus_byte_t *buffer, globus_size_t length,
+    globus_gridftp_server_read_cb_t callback, void *user_arg)
+{
+    if (harness_read_count == sizeof(harness_reads) / sizeof(harness_reads[0])) {return GLOBUS_FAILURE;}
+    harness_read_t *read = &harness_reads[harness_read_count++];
+    read->buffer = buffer;
+    read->length = length;
+    read->callback = callback;
+    read->user_arg = user_arg;
+    return GLOBUS_SUCCESS;
+}
+
+
+/*
+ * The stub DSI: completes every request immediately.
+ */
+static void
+stub_init(globus_gfs_operation_t op, globus_gfs_session_info_t *session)
+{
+    globus_gridftp_server_finished_session_start(op, GLOBUS_SUCCESS, NULL, NULL, NULL);
+}
+
+static void
+stub_destroy(void *user_arg)
+{
+}
+
+static void
+stub_command(globus_gfs_operation_t op, globus_gfs_command_info_t *cmd_info, void *user_arg)
+{
+    globus_gridftp_server_finished_command(op, GLOBUS_SUCCESS, NULL);
+}
+
+static void
+stub_stat(globus_gfs_operation_t op, globus_gfs_stat_info_t *stat_info, void *user_arg)
+{
+    globus_gfs_stat_t entry;
+    memset(&entry, '\0', sizeof(entry));
+    entry.mode = S_IFREG | 0644;
+    entry.nlink = 1;
+    entry.name = "stub";
+    globus_gridftp_server_finished_stat(op, GLOBUS_SUCCESS, &entry, 1);
+}
+
+static void
+stub_transfer(globus_gfs_operation_t op, globus_gfs_transfer_info_t *transfer_info, void *user_arg)
+{
+    globus_gridftp_server_finished_transfer(op, GLOBUS_SUCCESS);
+}
+
+static globus_gfs_storage_iface_t stub_dsi_iface =
+{
+    GLOBUS_GFS_DSI_DESCRIPTOR_BLOCKING,
+    stub_init,
+    stub_destroy,
+    NULL, /* list */
+    stub_transfer, /* send */
+    stub_transfer, /* recv */
+    NULL, /* trev */
+    NULL, /* active */
+    NULL, /* passive */
+    NULL, /* data destroy */
+    stub_command,
+    stub_stat,
+    NULL,
+    NULL
+};
+
+
+/*
+ * One operation of the benchmark, run against a DSI interface.
+ */
+typedef struct {
+    const char *name;
+    int iterations;
+    void (*run)(globus_gfs_storage_iface_t *iface);
+    // Checks the completion; NULL means "finished once, successfully".
+    int (*check)(void);
+} harness_case_t;
+
+static globus_gfs_session_info_t harness_session;
+static globus_gfs_command_info_t harness_cmd;
+static globus_gfs_stat_info_t harness_stat;
+static globus_gfs_transfer_info_t harness_transfer;
+
+static void
+run_session_start(globus_gfs_storage_iface_t *iface)
+{
+    iface->init_func(HARNESS_OP, &harness_session);
+}
+
+static void
+run_command(globus_gfs_storage_iface_t *iface)
+{
+    memset(&harness_cmd, '\0', sizeof(harness_cmd));
+    harness_cmd.command = GLOBUS_GFS_CMD_MKD;
+    harness_cmd.pathname = "/harness/dir";
+    iface->command_func(HARNESS_OP, &harness_cmd, NULL);
+}
+
+static void
+run_site_usage(globus_gfs_storage_iface_t *iface)
+{
+    memset(&harness_cmd, '\0', sizeof(harness_cmd));
+    // The OSG module's SITE USAGE is its first custom command.
+    harness_cmd.command = GLOBUS_GFS_MIN_CUSTOM_CMD;
+    harness_cmd.pathname = "/harness";
+    harness_argv[0] = "SITE";
+    harness_argv[1] = "USAGE";
+    harness_argv[2] = "/harness";
+    harness_argc = 3;
+    iface->command_func(HARNESS_OP, &harness_cmd, NULL);
+}
+
+static int
+check_site_usage(void)
+{
+    // The stub has no SITE USAGE; only the module must answer.
+    return (harness_op.finished == 1) && (harness_op.result == GLOBUS_SUCCESS) &&
+           (!harness_running_module || !strcmp(harness_op.response, "250 USAGE 1 FREE 2 TOTAL 3\r\n"));
+}
+
+static void
+run_stat(globus_gfs_storage_iface_t *iface)
+{
+    memset(&harness_stat, '\0', sizeof(harness_stat));
+    harness_stat.pathname = "/harness/file";
+    harness_stat.file_only = GLOBUS_TRUE;
+    iface->stat_func(HARNESS_OP, &harness_stat, NULL);
+}
+
+static int
+check_stat(void)
+{
+    return (harness_op.finished == 1) && (harness_op.result == GLOBUS_SUCCESS) && (harness_op.stat_count == 1);
+}
+
+static void
+run_send(globus_gfs_storage_iface_t *iface)
+{
+    memset(&harness_transfer, '\0', sizeof(harness_transfer));
+    harness_transfer.pathname = "/harness/file";
+    harness_transfer.partial_length = -1;
+    iface->send_func(HARNESS_OP, &harness_transfer, NULL);
+}
+
+static void
+run_recv(globus_gfs_storage_iface_t *iface)
+{
+    memset(&harness_transfer, '\0', sizeof(harness_transfer));
+    harness_transfer.pathname = "/harness/file";
+    harness_transfer.partial_length = -1;
+    harness_transfer.truncate = GLOBUS_TRUE;
+    iface->recv_func(HARNESS_OP, &harness_transfer, NULL);
+}
+
+static harness_case_t harness_cases[] =
+{
+    {"session start", HARNESS_DEFAULT_ITERATIONS, run_session_start, NULL},
+    {"command (MKD)", HARNESS_DEFAULT_ITERATIONS, run_command, NULL},
+    {"SITE USAGE", HARNESS_USAGE_ITERATIONS, run_site_usage, check_site_usage},
+    {"stat", HARNESS_DEFAULT_ITERATIONS, run_stat, check_stat},
+    {"send", HARNESS_DEFAULT_ITERATIONS, run_send, NULL},
+    {"recv", HARNESS_DEFAULT_ITERATIONS, run_recv, NULL},
+    {NULL, 0, NULL, NULL}
+};
+
+
+/*
+ * Run `iterations` calls of a case; returns 0 if any call did not
+ * complete correctly.  Per-call cost is returned through the pointers.
+ */
+static int
+harness_measure(const harness_case_t *test, globus_gfs_storage_iface_t *iface, int iterations,
+                double *us_per_call, double *allocs_per_call)
+{
+    struct timespec start, end;
+    unsigned long allocs_start = harness_allocs;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int idx;
+    for (idx = 0; idx < iterations; idx++) {
+        harness_op_reset();
+        test->run(iface);
+        int ok = test->check ? test->check() : ((harness_op.finished == 1) && (harness_op.result == GLOBUS_SUCCESS));
+        if (!ok) {
+            fprintf(stderr, "%s: call %d did not complete correctly (finished %d times, result %lu).\n",
+                test->name, idx, harness_op.finished, (unsigned long)harness_op.result);
+            return 0;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed_us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    *us_per_call = elapsed_us / iterations;
+    *allocs_per_call = (double)(harness_allocs - allocs_start) / iterations;
+    return 1;
+}
+
+
+static int
+harness_write_usage_script(char *script_name, size_t script_name_len, const char *output)
+{
+    snprintf(script_name, script_name_len, "/tmp/osg-dsi-harness-usage.XXXXXX");
+    int fd = mkstemp(script_name);
+    if (fd == -1) {return 0;}
+    char script[128];
+    snprintf(script, sizeof(script), "#!/bin/sh\necho %s\n", output);
+    int ok = (write(fd, script, strlen(script)) == (ssize_t)strlen(script)) && (fchmod(fd, 0755) == 0);
+    close(fd);
+    return ok;
+}
+
+
+static int
+harness_benchmark(globus_gfs_storage_iface_t *osg_iface, int iterations, double max_added_us)
+{
+    int rc = 0;
+    printf("%-14s %12s %12s %12s %12s %12s %12s\n", "operation", "stub us", "stub allocs",
+        "osg us", "osg allocs", "added us", "added allocs");
+    const harness_case_t *test;
+    for (test = harness_cases; test->name; test++) {
+        int count = test->iterations < iterations ? test->iterations : iterations;
+        double stub_us, stub_allocs, osg_us, osg_allocs;
+        // Warm up both paths (lazy initialization, page faults) first.
+        int ok = harness_measure(test, &stub_dsi_iface, 1, &stub_us, &stub_allocs);
+        harness_running_module = 1;
+        ok = ok && harness_measure(test, osg_iface, 1, &osg_us, &osg_allocs);
+        harness_running_module = 0;
+        ok = ok && harness_measure(test, &stub_dsi_iface, count, &stub_us, &stub_allocs);
+        harness_running_module = 1;
+        ok = ok && harness_measure(test, osg_iface, count, &osg_us, &osg_allocs);
+        harness_running_module = 0;
+        if (!ok) {
+            rc = 1;
+            continue;
+        }
+        printf("%-14s %12.3f %12.2f %12.3f %12.2f %12.3f %12.2f\n", test->name, stub_us, stub_allocs,
+            osg_us, osg_allocs, osg_us - stub_us, osg_allocs - stub_allocs);
+        if ((max_added_us >= 0) && (osg_us - stub_us > max_added_us)) {
+            fprintf(stderr, "%s: added latency %.3fus exceeds OSG_HARNESS_MAX_ADDED_US=%.3f.\n",
+                test->name, osg_us - stub_us, max_added_us);
+            rc = 1;
+        }
+    }
+    return rc;
+}
+
+
+/*
+ * --files mode: functional tests of the file-backed paths.
+ */
+static char harness_dir[64];
+
+static void
+harness_path(char *path, size_t path_len, const char *name)
+{
+    snprintf(path, path_len, "%s/%s", harness_dir, name);
+}
+
+static globus_byte_t
+harness_byte(globus_off_t offset)
+{
+    return (globus_byte_t)((offset * 7 + offset / 251) & 0xff);
+}
+
+static uint32_t
+harness_adler32(const globus_byte_t *buffer, size_t nbytes)
+{
+    uint32_t a = 1, b = 0;
+    size_t idx;
+    for (idx = 0; idx < nbytes; idx++) {
+        a = (a + buffer[idx]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Start an upload of `pathname` through the module.
+static void
+harness_recv(globus_gfs_storage_iface_t *iface, const char *pathname, globus_off_t alloc_size)
+{
+    harness_op_reset();
+    memset(&harness_transfer, '\0', sizeof(harness_transfer));
+    harness_transfer.pathname = (char *)pathname;
+    harness_transfer.partial_length = -1;
+    harness_transfer.truncate = GLOBUS_TRUE;
+    harness_transfer.alloc_size = alloc_size;
+    iface->recv_func(HARNESS_OP, &harness_transfer, NULL);
+}
+
+// Complete the `which`-th outstanding read with the block at `offset`.
+static int
+harness_deliver(int which, globus_off_t offset, globus_size_t nbytes)
+{
+    if ((which >= harness_read_count) || (nbytes > harness_reads[which].length)) {return 0;}
+    harness_read_t read = harness_reads[which];
+    memmove(&harness_reads[which], &harness_reads[which + 1], (harness_read_count - which - 1) * sizeof(read));
+    harness_read_count--;
+    globus_off_t idx;
+    for (idx = 0; idx < (globus_off_t)nbytes; idx++) {read.buffer[idx] = harness_byte(offset + idx);}
+    read.callback(HARNESS_OP, GLOBUS_SUCCESS, read.buffer, nbytes, offset, GLOBUS_FALSE, read.user_arg);
+    return 1;
+}
+
+// Complete every outstanding read with end-of-file.
+static void
+harness_deliver_eof(void)
+{
+    while (harness_read_count) {
+        harness_read_t read = harness_reads[--harness_read_count];
+        read.callback(HARNESS_OP, GLOBUS_SUCCESS, read.buffer, 0, 0, GLOBUS_TRUE, read.user_arg);
+    }
+}
+
+// Upload `size` bytes, delivering the blocks of each group of
+// HARNESS_CONCURRENCY in reverse order, as parallel streams might.
+static int
+harness_upload(globus_gfs_storage_iface_t *iface, const char *pathname, globus_off_t size)
+{
+    harness_recv(iface, pathname, size);
+    if (harness_op.finished) {return 0;}
+    globus_off_t blocks = (size + HARNESS_BLOCK_SIZE - 1) / HARNESS_BLOCK_SIZE;
+    globus_off_t group;
+    for (group = 0; group < blocks; group += HARNESS_CONCURRENCY) {
+        globus_off_t block;
+        for (block = group + HARNESS_CONCURRENCY - 1; block >= group; block--) {
+            if (block >= blocks) {continue;}
+            globus_off_t offset = block * HARNESS_BLOCK_SIZE;
+            globus_size_t nbytes = (size - offset < HARNESS_BLOCK_SIZE) ? size - offset : HARNESS_BLOCK_SIZE;
+            if (!harness_deliver(0, offset, nbytes)) {return 0;}
+        }
+    }
+    harness_deliver_eof();
+    return (harness_op.finished == 1) && (harness_op.result == GLOBUS_SUCCESS);
+}
+
+static int
+harness_command(globus_gfs_storage_iface_t *iface, int command, const char *pathname, const char *cksm_alg)
+{
+    harness_op_reset();
+    memset(&harness_cmd, '\0', sizeof(harness_cmd));
+    harness_cmd.command = command;
+    harness_cmd.pathname = (char *)pathname;
+    harness_cmd.cksm_alg = (char *)cksm_alg;
+    harness_cmd.cksm_length = -1;
+    iface->command_func(HARNESS_OP, &harness_cmd, NULL);
+    return (harness_op.finished == 1) && (harness_op.result == GLOBUS_SUCCESS);
+}
+
+// List directory `pathname`; returns the size of its entry `name`, or -1.
+static globus_off_t
+harness_list(globus_gfs_storage_iface_t *iface, const char *pathname, const char *name)
+{
+    harness_op_reset();
+    harness_op.stat_name = name;
+    memset(&harness_stat, '\0', sizeof(harness_stat));
+    harness_stat.pathname = (char *)pathname;
+    iface->stat_func(HARNESS_OP, &harness_stat, NULL);
+    return ((harness_op.finished == 1) && (harness_op.result == GLOBUS_SUCCESS)) ? harness_op.stat_size : -1;
+}
+
+static int
+harness_append(const char *pathname, const char *data)
+{
+    int fd = open(pathname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd == -1) {return 0;}
+    int ok = write(fd, data, strlen(data)) == (ssize_t)strlen(data);
+    close(fd);
+    return ok;
+}
+
+
+/*
+ * Blocks arriving out of order still give the right file and the right
+ * inline checksum, with gather and write-behind on.
+ */
+static int
+test_checksum_out_of_order(globus_gfs_storage_iface_t *iface)
+{
+    char pathname[128];
+    harness_path(pathname, sizeof(pathname), "data/cksm");
+    globus_off_t size = 16 * HARNESS_BLOCK_SIZE + 100;
+    if (!harness_upload(iface, pathname, size)) {return 0;}
+
+    globus_byte_t *contents = (globus_byte_t *)malloc(size + 1);
+    int fd = open(pathname, O_RDONLY);
+    ssize_t nread = (fd == -1) ? -1 : read(fd, contents, size + 1);
+    if (fd != -1) {close(fd);}
+    int ok = nread == size;
+    globus_off_t idx;
+    for (idx = 0; ok && (idx < size); idx++) {ok = contents[idx] == harness_byte(idx);}
+    if (!ok) {
+        free(contents);
+        fprintf(stderr, "checksum: uploaded file has the wrong contents.\n");
+        return 0;
+    }
+    char expected[16];
+    snprintf(expected, sizeof(expected), "%08x", harness_adler32(contents, size));
+    free(contents);
+
+    if (!harness_command(iface, GLOBUS_GFS_CMD_CKSM, pathname, "ADLER32") ||
+        strcmp(harness_op.response, expected))
+    {
+        fprintf(stderr, "checksum: CKSM answered '%s', expected '%s'.\n", harness_op.response, expected);
+        return 0;
+    }
+    return 1;
+}
+
+
+/*
+ * New files get the default mode less the umask, and restarted (REST) or
+ * partial (ESTO A) uploads go to the underlying DSI rather than being
+ * written from offset 0 over the data already there.
+ */
+static int
+test_restart(globus_gfs_storage_iface_t *iface)
+{
+    char pathname[128];
+    harness_path(pathname, sizeof(pathname), "data/restart");
+    globus_off_t size = 4 * HARNESS_BLOCK_SIZE;
+    if (!harness_upload(iface, pathname, size)) {return 0;}
+    mode_t mask = umask(0);
+    umask(mask);
+    struct stat st;
+    if ((stat(pathname, &st) == -1) || ((st.st_mode & 0777) != (0644 & ~mask))) {
+        fprintf(stderr, "restart: new file has mode %o, expected %o.\n", st.st_mode & 0777, 0644 & ~mask);
+        return 0;
+    }
+
+    int pass;
+    for (pass = 0; pass < 2; pass++) {
+        harness_op_reset();
+        memset(&harness_transfer, '\0', sizeof(harness_transfer));
+        harness_transfer.pathname = pathname;
+        harness_transfer.partial_length = -1;
+        if (pass == 0) {
+            // REST: keep what is there.
+            harness_transfer.truncate = GLOBUS_FALSE;
+        } else {
+            harness_transfer.truncate = GLOBUS_TRUE;
+            harness_transfer.partial_offset = 2 * HARNESS_BLOCK_SIZE;
+        }
+        iface->recv_func(HARNESS_OP, &harness_transfer, NULL);
+        if ((harness_op.finished != 1) || (harness_op.result != GLOBUS_SUCCESS) || harness_read_count) {
+            fprintf(stderr, "restart: %s upload was not left to the underlying DSI.\n", pass ? "partial" : "restarted");
+            harness_deliver_eof();
+            return 0;
+        }
+    }
+    if ((stat(pathname, &st) == -1) || (st.st_size != size)) {
+        fprintf(stderr, "restart: existing data was not kept.\n");
+        return 0;
+    }
+    return 1;
+}
+
+
+/*
+ * Cached listings are private, the cache directory is sticky, and a
+ * namespace command or upload invalidates a listing the directory times
+ * do not.
+ */
+static int
+test_listing_cache(globus_gfs_storage_iface_t *iface)
+{
+    char dir[128], file[128], cache_dir[128];
+    harness_path(dir, sizeof(dir), "list");
+    harness_path(file, sizeof(file), "list/file");
+    harness_path(cache_dir, sizeof(cache_dir), "cache");
+    if ((mkdir(dir, 0755) == -1) || !harness_append(file, "0123456789")) {return 0;}
+
+    if (harness_list(iface, dir, "file") != 10) {
+        fprintf(stderr, "listing cache: first listing is wrong.\n");
+        return 0;
+    }
+    struct stat st;
+    if ((stat(cache_dir, &st) == -1) || ((st.st_mode & 07777) != 01777)) {
+        fprintf(stderr, "listing cache: cache directory mode is %o, expected 1777.\n", st.st_mode & 07777);
+        return 0;
+    }
+    DIR *dp = opendir(cache_dir);
+    struct dirent *dent;
+    int listings = 0;
+    while (dp && (dent = readdir(dp))) {
+        if (dent->d_name[0] == '.') {continue;}
+        listings++;
+        if ((fstatat(dirfd(dp), dent->d_name, &st, 0) == -1) || ((st.st_mode & 0777) != 0600)) {
+            fprintf(stderr, "listing cache: %s has mode %o, expected 600.\n", dent->d_name, st.st_mode & 0777);
+            closedir(dp);
+            return 0;
+        }
+    }
+    if (dp) {closedir(dp);}
+    if (listings != 1) {
+        fprintf(stderr, "listing cache: found %d cached listings, expected 1.\n", listings);
+        return 0;
+    }
+
+    // Growing a file leaves the directory alone, so the cache still answers...
+    if (!harness_append(file, "01234") || (harness_list(iface, dir, "file") != 10)) {
+        fprintf(stderr, "listing cache: second listing was not served from the cache.\n");
+        return 0;
+    }
+    // ... until a command through the server touches the file.
+    if (!harness_command(iface, GLOBUS_GFS_CMD_TRNC, file, NULL) || (harness_list(iface, dir, "file") != 15)) {
+        fprintf(stderr, "listing cache: listing not invalidated.\n");
+        return 0;
+    }
+
+    // An upload left to the underlying DSI is invalidated again once it is
+    // done, dropping a listing another session took while it ran.
+    harness_op_reset();
+    memset(&harness_transfer, '\0', sizeof(harness_transfer));
+    harness_transfer.pathname = file;
+    harness_transfer.partial_length = -1;
+    harness_transfer.truncate = GLOBUS_FALSE;
+    iface->recv_func(HARNESS_OP, &harness_transfer, NULL);
+    sleep(1);
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == -1) {return 0;}
+    if (pid == 0) {_exit(harness_list(iface, dir, "file") == 15 ? 0 : 1);}
+    int status;
+    if ((waitpid(pid, &status, 0) == -1) || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "listing cache: other session's listing is wrong.\n");
+        return 0;
+    }
+    if (!harness_append(file, "01234") || (harness_list(iface, dir, "file") != 20)) {
+        fprintf(stderr, "listing cache: listing not invalidated after the upload.\n");
+        return 0;
+    }
+    return 1;
+}
+
+
+/*
+ * Reservations of other processes count against uploads into other
+ * directories of the same quota, and a finished upload's size comes off
+ * the cached free space.
+ */
+static int
+test_quota_ledger(globus_gfs_storage_iface_t *iface)
+{
+    char dir1[128], dir2[128], path1[128], path2[128];
+    harness_path(dir1, sizeof(dir1), "q1");
+    harness_path(dir2, sizeof(dir2), "q2");
+    harness_path(path1, sizeof(path1), "q1/file");
+    harness_path(path2, sizeof(path2), "q2/file");
+    if ((mkdir(dir1, 0755) == -1) || (mkdir(dir2, 0755) == -1)) {return 0;}
+
+    int ready[2], hold[2];
+    if ((pipe(ready) == -1) || (pipe(hold) == -1)) {return 0;}
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == -1) {return 0;}
+    if (pid == 0) {
+        // Another session: reserve 600 of the 1000 free bytes and hold on.
+        close(ready[0]);
+        close(hold[1]);
+        harness_recv(iface, path1, 600);
+        char status = harness_op.finished ? 'n' : 'y';
+        char byte;
+        if ((write(ready[1], &status, 1) == 1) && (read(hold[0], &byte, 1) == 0)) {_exit(0);}
+        _exit(1);
+    }
+    close(ready[1]);
+    close(hold[0]);
+    char status = 'n';
+    int ok = read(ready[0], &status, 1) == 1;
+    ok = ok && (status == 'y');
+    if (!ok) {fprintf(stderr, "quota: the other session's upload was not admitted.\n");}
+
+    harness_recv(iface, path2, 600);
+    if (ok && ((harness_op.finished != 1) || (harness_op.result == GLOBUS_SUCCESS))) {
+        fprintf(stderr, "quota: upload admitted despite the other session's reservation.\n");
+        ok = 0;
+    }
+    close(hold[1]);
+    close(ready[0]);
+    int child_status;
+    waitpid(pid, &child_status, 0);
+
+    if (ok && !harness_upload(iface, path2, 600)) {
+        fprintf(stderr, "quota: upload not admitted after the reservation was released.\n");
+        ok = 0;
+    }
+    harness_recv(iface, path2, 600);
+    if (ok && ((harness_op.finished != 1) || (harness_op.result == GLOBUS_SUCCESS))) {
+        fprintf(stderr, "quota: upload admitted against free space already used.\n");
+        ok = 0;
+    }
+    harness_deliver_eof();
+    return ok;
+}
+
+
+typedef struct {
+    const char *name;
+    int (*run)(globus_gfs_storage_iface_t *iface);
+} harness_test_t;
+
+static harness_test_t harness_file_tests[] =
+{
+    {"checksum (out of order)", test_checksum_out_of_order},
+    {"restart", test_restart},
+    {"listing cache", test_listing_cache},
+    {"quota ledger", test_quota_ledger},
+    {NULL, NULL}
+};
+
+
+static int
+harness_remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    remove(path);
+    return 0;
+}
+
+
+static int
+harness_run_file_tests(globus_gfs_storage_iface_t *osg_iface)
+{
+    int rc = 0;
+    char script_name[64];
+    if (!harness_write_usage_script(script_name, sizeof(script_name), "0 1000 1000")) {
+        fprintf(stderr, "Unable to create quota usage script.\n");
+        return 1;
+    }
+    setenv("OSG_SITE_USAGE_SCRIPT", script_name, 1);
+
+    const harness_test_t *test;
+    for (test = harness_file_tests; test->name; test++) {
+        // Quotas only for their own test; the other uploads are larger.
+        if (test->run == test_quota_ledger) {setenv("OSG_QUOTA_CHECK", "1", 1);}
+        int ok = test->run(osg_iface);
+        unsetenv("OSG_QUOTA_CHECK");
+        printf("%-24s %s\n", test->name, ok ? "ok" : "FAILED");
+        if (!ok) {rc = 1;}
+    }
+    unlink(script_name);
+    return rc;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int iterations = HARNESS_DEFAULT_ITERATIONS;
+    const char *iterations_char = getenv("OSG_HARNESS_ITERATIONS");
+    if (iterations_char && (atoi(iterations_char) > 0)) {iterations = atoi(iterations_char);}
+    double max_added_us = -1;
+    const char *max_added_char = getenv("OSG_HARNESS_MAX_ADDED_US");
+    if (max_added_char) {max_added_us = atof(max_added_char);}
+    int files_mode = (argc > 1) && !strcmp(argv[1], "--files");
+    const char *dsi_name = files_mode ? "file" : "stub";
+
+    // Keep the run self-contained: nothing shared with a real server on
+    // this host, and the module's optional features off.
+    setenv("OSG_EXTENSIONS_OVERRIDE_DSI", dsi_name, 1);
+    setenv("OSG_STARTUP_HISTOGRAM_FILE", "", 1);
+    unsetenv("GRIDFTP_TRANSFER_LIMIT");
+    unsetenv("GRIDFTP_DEFAULT_USER_TRANSFER_LIMIT");
+    unsetenv("OSG_QUOTA_CHECK");
+    char script_name[64];
+    if (!harness_write_usage_script(script_name, sizeof(script_name), "1 2 3")) {
+        fprintf(stderr, "Unable to create site usage script.\n");
+        return 1;
+    }
+    setenv("OSG_SITE_USAGE_SCRIPT", script_name, 1);
+
+    // --files: everything under a temporary directory, features on.
+    if (files_mode) {
+        strcpy(harness_dir, "/tmp/osg-dsi-harness.XXXXXX");
+        char path[128];
+        if (!mkdtemp(harness_dir)) {
+            fprintf(stderr, "Unable to create a temporary directory.\n");
+            unlink(script_name);
+            return 1;
+        }
+        harness_path(path, sizeof(path), "data");
+        mkdir(path, 0755);
+        char policy[128];
+        snprintf(policy, sizeof(policy), "%s:gather=%d,writebehind=%d", path, 8 * HARNESS_BLOCK_SIZE, 4 * HARNESS_BLOCK_SIZE);
+        setenv("OSG_WRITE_POLICY", policy, 1);
+        setenv("OSG_INLINE_CHECKSUM", "ADLER32", 1);
+        setenv("OSG_SMALL_FILE_THRESHOLD", "4K", 1);
+        setenv("OSG_LISTING_CACHE", "1", 1);
+        harness_path(path, sizeof(path), "cache");
+        setenv("OSG_LISTING_CACHE_DIR", path, 1);
+        harness_path(path, sizeof(path), "ledger");
+        setenv("OSG_QUOTA_LEDGER_FILE", path, 1);
+    }
+
+    struct passwd *pw = getpwuid(geteuid());
+    harness_session.username = pw ? pw->pw_name : "nobody";
+
+    int rc = 1;
+    if (globus_module_activate(GLOBUS_COMMON_MODULE) != GLOBUS_SUCCESS) {
+        fprintf(stderr, "Unable to activate globus_common.\n");
+        goto cleanup_script;
+    }
+    globus_extension_registry_add(GLOBUS_GFS_DSI_REGISTRY, (char *)dsi_name, NULL, &stub_dsi_iface);
+    if (globus_extension_activate("globus_gridftp_server_osg") != GLOBUS_SUCCESS) {
+        fprintf(stderr, "Unable to load the OSG DSI module (is it on LD_LIBRARY_PATH?).\n");
+        goto cleanup_common;
+    }
+    globus_extension_handle_t osg_handle = NULL;
+    globus_gfs_storage_iface_t *osg_iface = (globus_gfs_storage_iface_t *)globus_extension_lookup(
+        &osg_handle, GLOBUS_GFS_DSI_REGISTRY, "osg");
+    if (!osg_iface) {
+        fprintf(stderr, "The OSG DSI did not register itself.\n");
+        goto cleanup_module;
+    }
+
+    rc = files_mode ? harness_run_file_tests(osg_iface) : harness_benchmark(osg_iface, iterations, max_added_us);
+
+    globus_extension_release(osg_handle);
+cleanup_module:
+    globus_extension_deactivate("globus_gridftp_server_osg");
+cleanup_common:
+    globus_extension_registry_remove(GLOBUS_GFS_DSI_REGISTRY, (char *)dsi_name);
+    globus_module_deactivate(GLOBUS_COMMON_MODULE);
+cleanup_script:
+    unlink(script_name);
+    if (files_mode) {nftw(harness_dir, harness_remove_entry, 16, FTW_DEPTH | FTW_PHYS);}
+    return rc;
+}
@@ -78,6 +78,7 @@ port 2811
 
 load_dsi_module osg
 \$OSG_SITE_USAGE_SCRIPT /globus-gridftp-osg-extensions/site_usage.sh
+\$OSG_INLINE_CHECKSUM MD5,ADLER32
 
 log_level ERROR,WARN,INFO,TRANSFER
 log_single /var/log/gridftp-auth.log
@@ -92,6 +93,10 @@ dd if=/dev/zero of=/tmp/test.source bs=1024 count=1024
 
 sudo -u nobody globus-url-copy -dbg gsiftp://$HOSTNAME//tmp/test.source /tmp/test.result
 
+# Upload with checksum verification; served from the inline checksum.
+sudo -u nobody globus-url-copy -dbg -verify-checksum -checksum-alg MD5 file:///tmp/test.source gsiftp://$HOSTNAME//tmp/test.upload
+cmp /tmp/test.source /tmp/test.upload
+
 cat /var/log/gridftp-auth.log
 grep -q "VO osgtest /osgtest/Role=NULL" /var/log/gridftp-auth.log
 